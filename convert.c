@@ -0,0 +1,129 @@
+#include "convert.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CONVERT_X86 1
+#endif
+
+#if (defined(__aarch64__) || defined(__ARM_NEON)) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_neon.h>
+#define CONVERT_NEON 1
+#endif
+
+/* ---------- Scalar ---------- */
+// Packs whole words, so it is correct for either byte order.
+static void rgb_to_argb32_scalar(const unsigned char *src, unsigned char *dst, int n) {
+    for (int x = 0; x < n; x++) {
+        uint32_t px = 0xff000000u | (src[3*x] << 16) | (src[3*x + 1] << 8) | src[3*x + 2];
+        memcpy(dst + 4*x, &px, 4);
+    }
+}
+
+/* ---------- x86 ---------- */
+// Each 16-byte load holds four whole pixels (plus four bytes of the next),
+// which pshufb spreads into B,G,R,_ lanes before the alpha byte is OR'd in.
+// The loads over-read by four bytes, so the vector loops stop two pixels
+// short of the end and leave the tail to the scalar loop.
+#ifdef CONVERT_X86
+__attribute__((target("ssse3")))
+static void rgb_to_argb32_ssse3(const unsigned char *src, unsigned char *dst, int n) {
+    const __m128i mask  = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000u);
+    int x = 0;
+
+    for (; x + 18 <= n; x += 16) {
+        const unsigned char *s = src + 3*x;
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + 0));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + 12));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + 24));
+        __m128i d = _mm_loadu_si128((const __m128i *)(s + 36));
+        __m128i *o = (__m128i *)(dst + 4*x);
+        _mm_storeu_si128(o + 0, _mm_or_si128(_mm_shuffle_epi8(a, mask), alpha));
+        _mm_storeu_si128(o + 1, _mm_or_si128(_mm_shuffle_epi8(b, mask), alpha));
+        _mm_storeu_si128(o + 2, _mm_or_si128(_mm_shuffle_epi8(c, mask), alpha));
+        _mm_storeu_si128(o + 3, _mm_or_si128(_mm_shuffle_epi8(d, mask), alpha));
+    }
+    rgb_to_argb32_scalar(src + 3*x, dst + 4*x, n - x);
+}
+
+// vpshufb only shuffles within 128-bit lanes, so each lane gets its own
+// four-pixel load.
+__attribute__((target("avx2")))
+static void rgb_to_argb32_avx2(const unsigned char *src, unsigned char *dst, int n) {
+    const __m256i mask  = _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+                                           2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m256i alpha = _mm256_set1_epi32((int)0xff000000u);
+    int x = 0;
+
+    for (; x + 18 <= n; x += 16) {
+        const unsigned char *s = src + 3*x;
+        __m256i a = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(s + 0))),
+            _mm_loadu_si128((const __m128i *)(s + 12)), 1);
+        __m256i b = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(s + 24))),
+            _mm_loadu_si128((const __m128i *)(s + 36)), 1);
+        __m256i *o = (__m256i *)(dst + 4*x);
+        _mm256_storeu_si256(o + 0, _mm256_or_si256(_mm256_shuffle_epi8(a, mask), alpha));
+        _mm256_storeu_si256(o + 1, _mm256_or_si256(_mm256_shuffle_epi8(b, mask), alpha));
+    }
+    rgb_to_argb32_scalar(src + 3*x, dst + 4*x, n - x);
+}
+#endif
+
+/* ---------- ARM ---------- */
+#ifdef CONVERT_NEON
+static void rgb_to_argb32_neon(const unsigned char *src, unsigned char *dst, int n) {
+    int x = 0;
+
+    for (; x + 16 <= n; x += 16) {
+        uint8x16x3_t rgb = vld3q_u8(src + 3*x);
+        uint8x16x4_t bgra;
+        bgra.val[0] = rgb.val[2];
+        bgra.val[1] = rgb.val[1];
+        bgra.val[2] = rgb.val[0];
+        bgra.val[3] = vdupq_n_u8(0xff);
+        vst4q_u8(dst + 4*x, bgra);
+    }
+    rgb_to_argb32_scalar(src + 3*x, dst + 4*x, n - x);
+}
+#endif
+
+/* ---------- Dispatch ---------- */
+static convert_kernel kernels[4];
+static int            kernel_count = 0;
+static const char    *kernel_name  = "scalar";
+
+convert_fn rgb_to_argb32 = rgb_to_argb32_scalar;
+
+void convert_init(void) {
+    if (kernel_count) return;
+
+    kernels[kernel_count++] = (convert_kernel){ "scalar", rgb_to_argb32_scalar };
+#if defined(CONVERT_X86) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3"))
+        kernels[kernel_count++] = (convert_kernel){ "ssse3", rgb_to_argb32_ssse3 };
+    if (__builtin_cpu_supports("avx2"))
+        kernels[kernel_count++] = (convert_kernel){ "avx2", rgb_to_argb32_avx2 };
+#endif
+#ifdef CONVERT_NEON
+    kernels[kernel_count++] = (convert_kernel){ "neon", rgb_to_argb32_neon };
+#endif
+
+    rgb_to_argb32 = kernels[kernel_count - 1].fn;
+    kernel_name   = kernels[kernel_count - 1].name;
+}
+
+const char *convert_kernel_name(void) {
+    return kernel_name;
+}
+
+const convert_kernel *convert_kernels(int *count) {
+    convert_init();
+    *count = kernel_count;
+    return kernels;
+}
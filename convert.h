@@ -0,0 +1,26 @@
+#ifndef CONVERT_H
+#define CONVERT_H
+
+// Pixel conversion kernels for the RGB render fallback. Each kernel turns n
+// packed RGB pixels into n Cairo ARGB32 pixels (native-endian, opaque).
+
+typedef void (*convert_fn)(const unsigned char *src, unsigned char *dst, int n);
+
+typedef struct convert_kernel {
+    const char *name;
+    convert_fn  fn;
+} convert_kernel;
+
+// Picks the fastest kernel the CPU supports. Call once at startup, before
+// rgb_to_argb32 is used.
+void convert_init(void);
+
+// The kernel chosen by convert_init(); the scalar loop until then.
+extern convert_fn rgb_to_argb32;
+const char *convert_kernel_name(void);
+
+// Every kernel usable on this CPU, slowest first. The scalar loop is
+// always entry 0.
+const convert_kernel *convert_kernels(int *count);
+
+#endif
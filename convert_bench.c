@@ -0,0 +1,78 @@
+// Microbenchmark for the RGB -> ARGB32 kernels in convert.c.
+//
+//   gcc -O2 -o convert-bench convert_bench.c convert.c
+//   ./convert-bench [iterations]
+//
+// Converts an A4 page (595x842 pt) at 100/300/500% zoom with every kernel
+// the CPU supports, checks each result against the scalar loop, and prints
+// the best time per page.
+#include "convert.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void convert_page(convert_fn fn, const unsigned char *src, unsigned char *dst, int w, int h) {
+    for (int y = 0; y < h; y++)
+        fn(src + (size_t)y * w * 3, dst + (size_t)y * w * 4, w);
+}
+
+int main(int argc, char **argv) {
+    static const int zooms[] = { 100, 300, 500 };
+    int iterations = argc > 1 ? atoi(argv[1]) : 10;
+    if (iterations < 1) iterations = 1;
+
+    int count;
+    const convert_kernel *kernels = convert_kernels(&count);
+    printf("kernels available: %d, dispatch picks: %s\n", count, kernels[count - 1].name);
+
+    for (size_t z = 0; z < sizeof(zooms) / sizeof(zooms[0]); z++) {
+        int w = 595 * zooms[z] / 100;
+        int h = 842 * zooms[z] / 100;
+        size_t npix = (size_t)w * h;
+
+        unsigned char *src = malloc(npix * 3);
+        unsigned char *ref = malloc(npix * 4);
+        unsigned char *dst = malloc(npix * 4);
+        if (!src || !ref || !dst) {
+            fprintf(stderr, "out of memory at %d%%\n", zooms[z]);
+            return 1;
+        }
+
+        srand(1234);
+        for (size_t i = 0; i < npix * 3; i++) src[i] = (unsigned char)rand();
+        convert_page(kernels[0].fn, src, ref, w, h);
+
+        printf("\nA4 @ %d%% (%dx%d)\n", zooms[z], w, h);
+        double scalar_ms = 0;
+        for (int k = 0; k < count; k++) {
+            memset(dst, 0, npix * 4);
+            double best = 1e30;
+            for (int i = 0; i < iterations; i++) {
+                double t0 = now_ms();
+                convert_page(kernels[k].fn, src, dst, w, h);
+                double t = now_ms() - t0;
+                if (t < best) best = t;
+            }
+            if (k == 0) scalar_ms = best;
+
+            int ok = memcmp(dst, ref, npix * 4) == 0;
+            printf("  %-8s %8.3f ms  %8.1f Mpix/s  %5.2fx  %s\n",
+                   kernels[k].name, best, npix / best / 1e3,
+                   scalar_ms / best, ok ? "ok" : "MISMATCH");
+            if (!ok) return 1;
+        }
+
+        free(src);
+        free(ref);
+        free(dst);
+    }
+    return 0;
+}
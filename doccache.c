@@ -0,0 +1,341 @@
+#include "doccache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define DOC_CACHE_MAGIC "GUFCACHE"
+#define DOC_CACHE_BOM   0x01020304u
+#define FINGERPRINT_BYTES (64 * 1024)
+
+typedef struct cache_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t bom;
+    uint32_t page_count;
+    uint32_t section_count;
+} cache_header;
+
+typedef struct cache_section {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t size;
+    uint64_t offset;
+} cache_section;
+
+struct doc_cache {
+    GMappedFile         *file;
+    const char          *data;
+    size_t               length;
+    int                  page_count;
+    const cache_section *sections;
+    uint32_t             section_count;
+
+    const float          *sizes;        // DOC_CACHE_PAGE_SIZES, or NULL
+    const uint32_t       *first_word;   // DOC_CACHE_TEXT, or NULL
+    const doc_cache_word *words;
+    const char           *pool;
+    const doc_cache_thumb *thumbs;      // DOC_CACHE_THUMBNAILS, or NULL
+    const uint16_t        *thumb_pixels;
+};
+
+/* ---------- Naming ---------- */
+static void hash_file_range(GChecksum *sum, FILE *f, long offset, size_t len) {
+    unsigned char buf[8192];
+    if (fseek(f, offset, SEEK_SET) != 0) return;
+    while (len > 0) {
+        size_t n = fread(buf, 1, MIN(len, sizeof(buf)), f);
+        if (n == 0) break;
+        g_checksum_update(sum, buf, n);
+        len -= n;
+    }
+}
+
+char *doc_cache_path(const char *pdf_path) {
+    struct stat st;
+    if (!pdf_path || stat(pdf_path, &st) != 0) return NULL;
+    FILE *f = fopen(pdf_path, "rb");
+    if (!f) return NULL;
+
+    // Hashing the whole file would cost as much as the work being cached,
+    // so only its ends go in; size and mtime catch edits in the middle.
+    GChecksum *sum = g_checksum_new(G_CHECKSUM_SHA256);
+    int64_t stamp[2] = { (int64_t)st.st_size, (int64_t)st.st_mtime };
+    g_checksum_update(sum, (const guchar *)stamp, sizeof(stamp));
+    hash_file_range(sum, f, 0, FINGERPRINT_BYTES);
+    if (st.st_size > FINGERPRINT_BYTES)
+        hash_file_range(sum, f, (long)MAX(st.st_size - FINGERPRINT_BYTES, FINGERPRINT_BYTES),
+                        FINGERPRINT_BYTES);
+    fclose(f);
+
+    char *name = g_strdup_printf("%s.cache", g_checksum_get_string(sum));
+    char *path = g_build_filename(g_get_user_cache_dir(), "guf", name, NULL);
+    g_checksum_free(sum);
+    g_free(name);
+    return path;
+}
+
+/* ---------- Reading ---------- */
+const void *doc_cache_section(doc_cache *cache, uint32_t type, size_t *size) {
+    for (uint32_t i = 0; i < cache->section_count; i++) {
+        if (cache->sections[i].type != type) continue;
+        *size = cache->sections[i].size;
+        return cache->data + cache->sections[i].offset;
+    }
+    return NULL;
+}
+
+// Checks the text section's bounds once, so lookups can trust it.
+static int map_text(doc_cache *cache, const char *data, size_t size) {
+    size_t index_bytes = ((size_t)cache->page_count + 1) * sizeof(uint32_t);
+    if (size < index_bytes) return 0;
+    const uint32_t *first = (const uint32_t *)data;
+    size_t nwords = first[cache->page_count];
+    if (first[0] != 0 || nwords > (size - index_bytes) / sizeof(doc_cache_word)) return 0;
+    for (int p = 0; p < cache->page_count; p++)
+        if (first[p] > first[p + 1]) return 0;
+
+    const doc_cache_word *words = (const doc_cache_word *)(data + index_bytes);
+    const char *pool = (const char *)(words + nwords);
+    size_t pool_size = size - index_bytes - nwords * sizeof(doc_cache_word);
+    for (size_t i = 0; i < nwords; i++)
+        if (words[i].text > pool_size || words[i].len > pool_size - words[i].text) return 0;
+
+    cache->first_word = first;
+    cache->words      = words;
+    cache->pool       = pool;
+    return 1;
+}
+
+static int map_thumbnails(doc_cache *cache, const char *data, size_t size) {
+    size_t table_bytes = (size_t)cache->page_count * sizeof(doc_cache_thumb);
+    if (size < table_bytes) return 0;
+    const doc_cache_thumb *thumbs = (const doc_cache_thumb *)data;
+    size_t npixels = (size - table_bytes) / sizeof(uint16_t);
+    for (int p = 0; p < cache->page_count; p++) {
+        size_t n = (size_t)thumbs[p].w * thumbs[p].h;
+        if (thumbs[p].offset > npixels || n > npixels - thumbs[p].offset) return 0;
+    }
+    cache->thumbs       = thumbs;
+    cache->thumb_pixels = (const uint16_t *)(data + table_bytes);
+    return 1;
+}
+
+doc_cache *doc_cache_open(const char *path, int page_count) {
+    if (!path) return NULL;
+    GMappedFile *file = g_mapped_file_new(path, FALSE, NULL);
+    if (!file) return NULL;
+
+    doc_cache *cache = g_new0(doc_cache, 1);
+    cache->file       = file;
+    cache->data       = g_mapped_file_get_contents(file);
+    cache->length     = g_mapped_file_get_length(file);
+    cache->page_count = page_count;
+
+    const cache_header *h = (const cache_header *)cache->data;
+    if (cache->length < sizeof(*h) || memcmp(h->magic, DOC_CACHE_MAGIC, 8) != 0 ||
+        h->version != DOC_CACHE_VERSION || h->bom != DOC_CACHE_BOM ||
+        h->page_count != (uint32_t)page_count ||
+        h->section_count > (cache->length - sizeof(*h)) / sizeof(cache_section))
+        goto fail;
+
+    cache->sections      = (const cache_section *)(cache->data + sizeof(*h));
+    cache->section_count = h->section_count;
+    for (uint32_t i = 0; i < cache->section_count; i++) {
+        const cache_section *s = &cache->sections[i];
+        if (s->offset > cache->length || s->size > cache->length - s->offset || s->offset % 8)
+            goto fail;
+    }
+
+    size_t size;
+    const void *sizes = doc_cache_section(cache, DOC_CACHE_PAGE_SIZES, &size);
+    if (sizes && size == (size_t)page_count * 4 * sizeof(float))
+        cache->sizes = sizes;
+    const void *text = doc_cache_section(cache, DOC_CACHE_TEXT, &size);
+    if (text && !map_text(cache, text, size))
+        goto fail;
+    const void *thumbs = doc_cache_section(cache, DOC_CACHE_THUMBNAILS, &size);
+    if (thumbs && !map_thumbnails(cache, thumbs, size))
+        goto fail;
+    return cache;
+
+fail:
+    doc_cache_close(cache);
+    return NULL;
+}
+
+void doc_cache_close(doc_cache *cache) {
+    if (!cache) return;
+    g_mapped_file_unref(cache->file);
+    g_free(cache);
+}
+
+gboolean doc_cache_page_size(doc_cache *cache, int page, float box[4]) {
+    if (!cache->sizes || page < 0 || page >= cache->page_count) return FALSE;
+    memcpy(box, cache->sizes + 4 * page, 4 * sizeof(float));
+    return TRUE;
+}
+
+int doc_cache_page_words(doc_cache *cache, int page, const doc_cache_word **words, const char **pool) {
+    if (!cache->first_word || page < 0 || page >= cache->page_count) return -1;
+    *words = cache->words + cache->first_word[page];
+    *pool  = cache->pool;
+    return cache->first_word[page + 1] - cache->first_word[page];
+}
+
+gboolean doc_cache_page_thumbnail(doc_cache *cache, int page, const uint16_t **pixels, int *w, int *h) {
+    if (!cache->thumbs || page < 0 || page >= cache->page_count || !cache->thumbs[page].w) return FALSE;
+    *pixels = cache->thumb_pixels + cache->thumbs[page].offset;
+    *w = cache->thumbs[page].w;
+    *h = cache->thumbs[page].h;
+    return TRUE;
+}
+
+/* ---------- Writing ---------- */
+struct doc_cache_writer {
+    int         page_count;
+    float      *sizes;
+    int         have_sizes;
+    int         have_text;
+    uint32_t   *first_word;
+    int         last_page;
+    GArray     *words;      // doc_cache_word
+    GString    *pool;
+    GHashTable *pool_index; // word -> offset + 1, so repeats share their text
+    doc_cache_thumb *thumbs;
+    GArray     *thumb_pixels; // uint16_t
+    GPtrArray  *extra;      // GBytes, prefixed with the section type
+};
+
+doc_cache_writer *doc_cache_writer_new(int page_count) {
+    doc_cache_writer *w = g_new0(doc_cache_writer, 1);
+    w->page_count = page_count;
+    w->sizes      = g_new0(float, 4 * MAX(page_count, 1));
+    w->first_word = g_new0(uint32_t, page_count + 1);
+    w->words      = g_array_new(FALSE, FALSE, sizeof(doc_cache_word));
+    w->pool       = g_string_new("");
+    w->pool_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    w->thumbs     = g_new0(doc_cache_thumb, MAX(page_count, 1));
+    w->thumb_pixels = g_array_new(FALSE, FALSE, sizeof(uint16_t));
+    w->extra      = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+    return w;
+}
+
+void doc_cache_writer_free(doc_cache_writer *w) {
+    if (!w) return;
+    g_free(w->sizes);
+    g_free(w->first_word);
+    g_array_free(w->words, TRUE);
+    g_string_free(w->pool, TRUE);
+    g_hash_table_destroy(w->pool_index);
+    g_free(w->thumbs);
+    g_array_free(w->thumb_pixels, TRUE);
+    g_ptr_array_unref(w->extra);
+    g_free(w);
+}
+
+void doc_cache_writer_set_page_size(doc_cache_writer *w, int page, const float box[4]) {
+    if (page < 0 || page >= w->page_count) return;
+    memcpy(w->sizes + 4 * page, box, 4 * sizeof(float));
+    w->have_sizes = 1;
+}
+
+void doc_cache_writer_set_text(doc_cache_writer *w) {
+    w->have_text = 1;
+}
+
+void doc_cache_writer_add_word(doc_cache_writer *w, int page, const char *text, const float box[4]) {
+    if (page < w->last_page || page >= w->page_count) return;
+    w->have_text = 1;
+    for (; w->last_page < page; w->last_page++)
+        w->first_word[w->last_page + 1] = w->words->len;
+
+    doc_cache_word word = { 0, strlen(text), { box[0], box[1], box[2], box[3] } };
+    gpointer off = g_hash_table_lookup(w->pool_index, text);
+    if (off) {
+        word.text = GPOINTER_TO_UINT(off) - 1;
+    } else {
+        word.text = w->pool->len;
+        g_string_append_len(w->pool, text, word.len);
+        g_hash_table_insert(w->pool_index, g_strdup(text), GUINT_TO_POINTER(word.text + 1));
+    }
+    g_array_append_val(w->words, word);
+}
+
+void doc_cache_writer_set_thumbnail(doc_cache_writer *w, int page, const uint16_t *pixels, int tw, int th) {
+    if (page < 0 || page >= w->page_count || w->thumbs[page].w || tw <= 0 || th <= 0 ||
+        tw > UINT16_MAX || th > UINT16_MAX)
+        return;
+    w->thumbs[page] = (doc_cache_thumb){ w->thumb_pixels->len, tw, th };
+    g_array_append_vals(w->thumb_pixels, pixels, (guint)tw * th);
+}
+
+void doc_cache_writer_add_section(doc_cache_writer *w, uint32_t type, const void *data, size_t size) {
+    GByteArray *b = g_byte_array_sized_new(sizeof(type) + size);
+    g_byte_array_append(b, (const guint8 *)&type, sizeof(type));
+    g_byte_array_append(b, data, size);
+    g_ptr_array_add(w->extra, g_byte_array_free_to_bytes(b));
+}
+
+static void append_section(GByteArray *out, cache_section *table, uint32_t *n,
+                           uint32_t type, const void *data, size_t size) {
+    static const guint8 pad[8] = { 0 };
+    g_byte_array_append(out, pad, (8 - out->len % 8) % 8);
+    table[*n] = (cache_section){ type, 0, size, out->len };
+    g_byte_array_append(out, data, size);
+    (*n)++;
+}
+
+gboolean doc_cache_writer_save(doc_cache_writer *w, const char *path) {
+    for (; w->last_page < w->page_count; w->last_page++)
+        w->first_word[w->last_page + 1] = w->words->len;
+
+    uint32_t max_sections = 3 + w->extra->len;
+    size_t table_bytes = sizeof(cache_header) + max_sections * sizeof(cache_section);
+    GByteArray *out = g_byte_array_sized_new(table_bytes);
+    g_byte_array_set_size(out, table_bytes);
+    cache_section *table = g_new0(cache_section, max_sections);
+    uint32_t n = 0;
+
+    if (w->have_sizes)
+        append_section(out, table, &n, DOC_CACHE_PAGE_SIZES, w->sizes, 4 * sizeof(float) * w->page_count);
+
+    if (w->have_text) {
+        GByteArray *text = g_byte_array_new();
+        g_byte_array_append(text, (const guint8 *)w->first_word, (w->page_count + 1) * sizeof(uint32_t));
+        g_byte_array_append(text, (const guint8 *)w->words->data, w->words->len * sizeof(doc_cache_word));
+        g_byte_array_append(text, (const guint8 *)w->pool->str, w->pool->len);
+        append_section(out, table, &n, DOC_CACHE_TEXT, text->data, text->len);
+        g_byte_array_free(text, TRUE);
+    }
+
+    if (w->thumb_pixels->len) {
+        GByteArray *thumbs = g_byte_array_new();
+        g_byte_array_append(thumbs, (const guint8 *)w->thumbs, w->page_count * sizeof(doc_cache_thumb));
+        g_byte_array_append(thumbs, (const guint8 *)w->thumb_pixels->data, w->thumb_pixels->len * sizeof(uint16_t));
+        append_section(out, table, &n, DOC_CACHE_THUMBNAILS, thumbs->data, thumbs->len);
+        g_byte_array_free(thumbs, TRUE);
+    }
+
+    for (guint i = 0; i < w->extra->len; i++) {
+        gsize size;
+        const guint8 *data = g_bytes_get_data(g_ptr_array_index(w->extra, i), &size);
+        uint32_t type;
+        memcpy(&type, data, sizeof(type));
+        append_section(out, table, &n, type, data + sizeof(type), size - sizeof(type));
+    }
+
+    cache_header h = { DOC_CACHE_MAGIC, DOC_CACHE_VERSION, DOC_CACHE_BOM, w->page_count, n };
+    memcpy(out->data, &h, sizeof(h));
+    memcpy(out->data + sizeof(h), table, n * sizeof(cache_section));
+    g_free(table);
+
+    char *dir = g_path_get_dirname(path);
+    gboolean ok = g_mkdir_with_parents(dir, 0700) == 0 &&
+                  g_file_set_contents(path, (const char *)out->data, out->len, NULL);
+    if (!ok) fprintf(stderr, "Could not write cache file %s\n", path);
+    g_free(dir);
+    g_byte_array_free(out, TRUE);
+    doc_cache_writer_free(w);
+    return ok;
+}
@@ -0,0 +1,81 @@
+#ifndef DOCCACHE_H
+#define DOCCACHE_H
+
+#include <glib.h>
+#include <stdint.h>
+
+// Per-document data that is slow to recompute (page sizes, the search
+// text, sidebar thumbnails), kept in $XDG_CACHE_HOME/guf/ and memory-mapped on reopen. A cache
+// file is named after a fingerprint of the PDF (size, mtime and the bytes
+// at either end), so an edited or replaced file misses instead of loading
+// stale data.
+//
+// Layout, all integers native-endian:
+//   header    magic, version, byte-order mark, page count, section count
+//   sections  { type, size, offset } for each section that follows
+// A reader skips section types it does not know, so adding a section does
+// not need a version bump; changing an existing one does.
+#define DOC_CACHE_VERSION 1
+
+enum {
+    DOC_CACHE_PAGE_SIZES = 1,   // float[4] (x0, y0, x1, y1) per page
+    DOC_CACHE_TEXT       = 2,   // words per page, see doc_cache_page_words()
+    DOC_CACHE_THUMBNAILS = 3,   // RGB565 per page, see doc_cache_page_thumbnail()
+};
+
+typedef struct doc_cache_word {
+    uint32_t text;      // offset of the lower-cased UTF-8 word in the string pool
+    uint32_t len;
+    float    box[4];
+} doc_cache_word;
+
+// Thumbnail section: one of these per page, then the pixels. A page
+// without a thumbnail has w == 0.
+typedef struct doc_cache_thumb {
+    uint32_t offset;    // in pixels from the end of the table
+    uint16_t w, h;
+} doc_cache_thumb;
+
+typedef struct doc_cache doc_cache;
+typedef struct doc_cache_writer doc_cache_writer;
+
+// Where the cache for the PDF at pdf_path lives, or NULL if the file
+// cannot be read.
+char *doc_cache_path(const char *pdf_path);
+
+// Maps and checks the cache file; NULL if it is missing, from another
+// version or not for a document of page_count pages.
+doc_cache *doc_cache_open(const char *path, int page_count);
+void       doc_cache_close(doc_cache *cache);
+
+// Raw section contents, or NULL if the file has no such section.
+const void *doc_cache_section(doc_cache *cache, uint32_t type, size_t *size);
+
+// The page's bounds; FALSE if the cache has no page sizes. Pages whose
+// size was not known when the file was written come back empty.
+gboolean doc_cache_page_size(doc_cache *cache, int page, float box[4]);
+
+// The page's words in reading order. *pool holds their text; words are not
+// NUL-terminated. Returns the word count, or -1 if the cache has no text.
+int doc_cache_page_words(doc_cache *cache, int page, const doc_cache_word **words, const char **pool);
+
+// The page's thumbnail, w * h RGB565 pixels; FALSE if the file has none.
+gboolean doc_cache_page_thumbnail(doc_cache *cache, int page, const uint16_t **pixels, int *w, int *h);
+
+// Collects sections for a new cache file. Pages must be added in order,
+// each page's words in reading order. The text section is only written
+// once a word has been added or doc_cache_writer_set_text() says the
+// document's whole text is there (it may have none); a file with just
+// page sizes is read back as having no text. Thumbnails may be set for
+// any pages, in any order.
+doc_cache_writer *doc_cache_writer_new(int page_count);
+void     doc_cache_writer_set_page_size(doc_cache_writer *w, int page, const float box[4]);
+void     doc_cache_writer_set_text(doc_cache_writer *w);
+void     doc_cache_writer_add_word(doc_cache_writer *w, int page, const char *text, const float box[4]);
+void     doc_cache_writer_set_thumbnail(doc_cache_writer *w, int page, const uint16_t *pixels, int tw, int th);
+void     doc_cache_writer_add_section(doc_cache_writer *w, uint32_t type, const void *data, size_t size);
+// Writes atomically and frees the writer.
+gboolean doc_cache_writer_save(doc_cache_writer *w, const char *path);
+void     doc_cache_writer_free(doc_cache_writer *w);
+
+#endif
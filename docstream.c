@@ -0,0 +1,162 @@
+#include "docstream.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* ---------- GIO ---------- */
+#define GIO_CHUNK (64 * 1024)   // read-ahead per request; one HTTP range each
+
+// Copies the message out first: fz_throw does not return, so err would leak.
+static void throw_gerror(fz_context *ctx, const char *what, GError *err) __attribute__((noreturn));
+static void throw_gerror(fz_context *ctx, const char *what, GError *err) {
+    char msg[256];
+    g_strlcpy(msg, err ? err->message : "unknown error", sizeof(msg));
+    g_clear_error(&err);
+    fz_throw(ctx, FZ_ERROR_GENERIC, "%s: %s", what, msg);
+}
+
+typedef struct gio_state {
+    GInputStream *in;
+    int64_t       size;         // -1 until a SEEK_END needs it
+    unsigned char buf[GIO_CHUNK];
+} gio_state;
+
+static int gio_next(fz_context *ctx, fz_stream *stm, size_t max) {
+    gio_state *st = stm->state;
+    GError *err = NULL;
+
+    gssize n = g_input_stream_read(st->in, st->buf, MIN(max, sizeof(st->buf)), NULL, &err);
+    if (n < 0) throw_gerror(ctx, "read error", err);
+    stm->rp = st->buf;
+    stm->wp = st->buf + n;
+    stm->pos += n;
+    if (n == 0) return EOF;
+    return *stm->rp++;
+}
+
+static void gio_seek(fz_context *ctx, fz_stream *stm, int64_t offset, int whence) {
+    gio_state *st = stm->state;
+    GError *err = NULL;
+
+    if (whence == SEEK_END && st->size < 0) {
+        if (!g_seekable_seek(G_SEEKABLE(st->in), 0, G_SEEK_END, NULL, &err)) goto fail;
+        st->size = g_seekable_tell(G_SEEKABLE(st->in));
+    }
+    int64_t pos = whence == SEEK_SET ? offset :
+                  whence == SEEK_CUR ? stm->pos + offset : st->size + offset;
+    if (pos < 0) pos = 0;
+    if (!g_seekable_seek(G_SEEKABLE(st->in), pos, G_SEEK_SET, NULL, &err)) goto fail;
+
+    stm->pos = pos;
+    stm->rp = stm->wp = st->buf;
+    stm->eof = 0;
+    return;
+
+fail:
+    throw_gerror(ctx, "seek error", err);
+}
+
+static void gio_drop(fz_context *ctx, void *state) {
+    gio_state *st = state;
+    g_object_unref(st->in);
+    g_free(st);
+}
+
+// For locations that cannot seek: fetch everything, serve it from memory.
+static fz_stream *open_downloaded(fz_context *ctx, GFile *file) {
+    char *data = NULL;
+    gsize len = 0;
+    GError *err = NULL;
+    if (!g_file_load_contents(file, NULL, &data, &len, NULL, &err))
+        throw_gerror(ctx, "cannot load document", err);
+
+    fz_buffer *buf = NULL;
+    fz_stream *stm = NULL;
+    fz_var(buf);
+    fz_try(ctx) {
+        buf = fz_new_buffer_from_copied_data(ctx, (const unsigned char *)data, len);
+        stm = fz_open_buffer(ctx, buf);
+    } fz_always(ctx) {
+        fz_drop_buffer(ctx, buf);
+        g_free(data);
+    } fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+    return stm;
+}
+
+fz_stream *open_gio_stream(fz_context *ctx, GFile *file) {
+    GError *err = NULL;
+    GFileInputStream *in = g_file_read(file, NULL, &err);
+    if (!in) throw_gerror(ctx, "cannot open document", err);
+    if (!g_seekable_can_seek(G_SEEKABLE(in))) {
+        g_object_unref(in);
+        return open_downloaded(ctx, file);
+    }
+
+    gio_state *st = g_new0(gio_state, 1);
+    st->in   = G_INPUT_STREAM(in);
+    st->size = -1;
+
+    fz_stream *stm = NULL;
+    fz_try(ctx) {
+        stm = fz_new_stream(ctx, st, gio_next, gio_drop);
+    } fz_catch(ctx) {
+        gio_drop(ctx, st);
+        fz_rethrow(ctx);
+    }
+    stm->seek = gio_seek;
+    return stm;
+}
+
+/* ---------- Memory map ---------- */
+// The whole mapping is the stream's buffer, so next() only ever hands out
+// what is left of it and seek() just moves the read pointer.
+static int mapped_next(fz_context *ctx, fz_stream *stm, size_t max) {
+    GMappedFile *map = stm->state;
+    unsigned char *data = (unsigned char *)g_mapped_file_get_contents(map);
+    int64_t len = g_mapped_file_get_length(map);
+
+    if (stm->pos >= len) {
+        stm->rp = stm->wp = data + len;
+        return EOF;
+    }
+    stm->rp = data + stm->pos;
+    stm->wp = data + len;
+    stm->pos = len;
+    return *stm->rp++;
+}
+
+static void mapped_seek(fz_context *ctx, fz_stream *stm, int64_t offset, int whence) {
+    GMappedFile *map = stm->state;
+    int64_t len = g_mapped_file_get_length(map);
+    // pos counts what next() handed out; the reader is still behind it by
+    // whatever is left between rp and wp.
+    int64_t cur = stm->pos - (stm->wp - stm->rp);
+    int64_t pos = whence == SEEK_SET ? offset :
+                  whence == SEEK_CUR ? cur + offset : len + offset;
+
+    stm->pos = CLAMP(pos, 0, len);
+    stm->rp = stm->wp = (unsigned char *)g_mapped_file_get_contents(map) + stm->pos;
+    stm->eof = 0;
+}
+
+static void mapped_drop(fz_context *ctx, void *state) {
+    g_mapped_file_unref(state);
+}
+
+fz_stream *open_mapped_stream(fz_context *ctx, const char *path) {
+    GError *err = NULL;
+    GMappedFile *map = g_mapped_file_new(path, FALSE, &err);
+    if (!map) throw_gerror(ctx, "cannot map document", err);
+
+    fz_stream *stm = NULL;
+    fz_try(ctx) {
+        stm = fz_new_stream(ctx, map, mapped_next, mapped_drop);
+    } fz_catch(ctx) {
+        g_mapped_file_unref(map);
+        fz_rethrow(ctx);
+    }
+    stm->seek = mapped_seek;
+    return stm;
+}
@@ -0,0 +1,21 @@
+#ifndef DOCSTREAM_H
+#define DOCSTREAM_H
+
+#include <gio/gio.h>
+#include <mupdf/fitz.h>
+
+// fz_stream backends that open_pdf can use instead of MuPDF's buffered
+// file reader.
+
+// A stream over any GIO location (sftp://, smb://, http(s):// via gvfs, ...).
+// Reads are ranged: MuPDF's seeks become GSeekable seeks, so only the parts
+// of the file it touches are fetched. Falls back to downloading the whole
+// file when the location cannot seek. Throws on failure.
+fz_stream *open_gio_stream(fz_context *ctx, GFile *file);
+
+// A stream straight over a read-only mapping of a local file, so the
+// kernel's page cache serves MuPDF's reads without a copy in stdio
+// buffers. Throws on failure. The file must not be truncated while open.
+fz_stream *open_mapped_stream(fz_context *ctx, const char *path);
+
+#endif
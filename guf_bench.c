@@ -0,0 +1,284 @@
+// Headless benchmark for the render core in render.c, the same code the
+// viewer draws with.
+//
+//   gcc -O2 -o guf-bench guf_bench.c render.c convert.c $(pkg-config --cflags --libs glib-2.0 cairo) -lmupdf -lm
+//   ./guf-bench [--zoom=1,2,4] [--pages=N] [--repeat=R] [--cache-mb=MB] [--draft] file.pdf...
+//
+// Every page of every file is requested at each zoom, R times over, the
+// way the viewer asks for its current page: a page cache lookup, then a
+// visible-priority job on the worker pool, split into tiles when the page
+// is too large for one surface. Prints one JSON object to stdout with
+// per-zoom latency percentiles, pixel throughput and cache hit rates, how
+// often the pixel buffer pool reused a buffer, and the process's peak RSS.
+#include "render.h"
+#include "convert.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+static fz_context *ctx = NULL;
+static int         quality = RENDER_QUALITY_FULL;
+
+typedef struct bench_run {
+    float   zoom;
+    GArray *latency_ms;     // double, one per page request
+    double  wall_ms;
+    guint64 pixels;
+    int     failed;
+    guint   page_hits, page_misses;
+    guint   list_hits, list_misses;
+} bench_run;
+
+/* ---------- Requests ---------- */
+// Jobs out on the pool for the current page request, and what came back.
+static int     jobs_out    = 0;
+static int     jobs_failed = 0;
+static guint64 jobs_pixels = 0;
+static int     page_too_large = 0;
+static fz_rect page_bounds;
+
+static gboolean bench_job_done(gpointer data) {
+    render_job *job = data;
+    if (job->surface) {
+        jobs_pixels += (guint64)cairo_image_surface_get_width(job->surface) *
+                       cairo_image_surface_get_height(job->surface);
+        page_cache_insert(job->key, job->surface);
+    }
+    if (job->too_large) {
+        page_too_large = 1;
+        page_bounds = job->bounds;
+    } else if (job->failed) {
+        jobs_failed++;
+    }
+    jobs_out--;
+    render_job_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+static void push_job(fz_document *doc, cache_key key, int page, float zoom) {
+    render_job *job = g_new0(render_job, 1);
+    job->page       = page;
+    job->zoom       = zoom;
+    job->key        = key;
+    job->priority   = JOB_PRIO_VISIBLE;
+    job->quality    = quality;
+    job->generation = g_atomic_int_get(&render_generation);
+    job->doc        = fz_keep_document(ctx, doc);
+    jobs_out++;
+    render_queue_push(job);
+}
+
+static void wait_for_jobs(void) {
+    while (jobs_out > 0)
+        g_main_context_iteration(NULL, TRUE);
+}
+
+// Renders every tile of a page that page_needs_tiles(), in parallel.
+static void request_tiles(fz_document *doc, int page, float zoom) {
+    fz_irect bbox = page_pixel_bbox(page_bounds, zoom);
+    int cols = (bbox.x1 - bbox.x0 + TILE_SIZE - 1) / TILE_SIZE;
+    int rows = (bbox.y1 - bbox.y0 + TILE_SIZE - 1) / TILE_SIZE;
+    for (int ty = 0; ty < rows; ty++) {
+        for (int tx = 0; tx < cols; tx++) {
+            cache_key key = make_tile_key(page, zoom, tx, ty);
+            if (page_cache_lookup(key)) continue;
+            push_job(doc, key, page, zoom);
+        }
+    }
+    wait_for_jobs();
+}
+
+static void request_page(fz_document *doc, int page, float zoom, bench_run *run) {
+    jobs_failed    = 0;
+    jobs_pixels    = 0;
+    page_too_large = 0;
+
+    gint64 start = g_get_monotonic_time();
+    if (!page_cache_lookup(make_cache_key(page, zoom))) {
+        push_job(doc, make_cache_key(page, zoom), page, zoom);
+        wait_for_jobs();
+        if (page_too_large) request_tiles(doc, page, zoom);
+    }
+    double ms = (g_get_monotonic_time() - start) / 1000.0;
+
+    g_array_append_val(run->latency_ms, ms);
+    run->pixels += jobs_pixels;
+    if (jobs_failed) run->failed++;
+}
+
+/* ---------- Reporting ---------- */
+static void json_string(const char *s) {
+    putchar('"');
+    for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+        if (*p == '"' || *p == '\\') printf("\\%c", *p);
+        else if (*p < 0x20) printf("\\u%04x", *p);
+        else putchar(*p);
+    }
+    putchar('"');
+}
+
+static int compare_double(const void *a, const void *b) {
+    double da = *(const double *)a, db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+// Nearest-rank percentile of a sorted array.
+static double percentile(const double *v, guint n, double p) {
+    if (n == 0) return 0.0;
+    guint rank = (guint)ceil(p / 100.0 * n);
+    return v[CLAMP(rank, 1, n) - 1];
+}
+
+static double hit_rate(guint hits, guint misses) {
+    return hits + misses ? (double)hits / (hits + misses) : 0.0;
+}
+
+static void print_run(bench_run *run) {
+    double *v = (double *)run->latency_ms->data;
+    guint n = run->latency_ms->len;
+    double sum = 0.0;
+    for (guint i = 0; i < n; i++) sum += v[i];
+    qsort(v, n, sizeof(double), compare_double);
+
+    printf("        { \"zoom\": %g, \"requests\": %u, \"failed\": %d,\n", run->zoom, n, run->failed);
+    printf("          \"latency_ms\": { \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n",
+           n ? sum / n : 0.0, percentile(v, n, 50), percentile(v, n, 90), percentile(v, n, 99),
+           n ? v[n - 1] : 0.0);
+    printf("          \"wall_ms\": %.3f, \"megapixels\": %.3f, \"megapixels_per_s\": %.3f,\n",
+           run->wall_ms, run->pixels / 1e6, run->wall_ms > 0 ? run->pixels / 1e3 / run->wall_ms : 0.0);
+    printf("          \"page_cache\": { \"hits\": %u, \"misses\": %u, \"hit_rate\": %.4f },\n",
+           run->page_hits, run->page_misses, hit_rate(run->page_hits, run->page_misses));
+    printf("          \"list_cache\": { \"hits\": %u, \"misses\": %u, \"hit_rate\": %.4f } }",
+           run->list_hits, run->list_misses, hit_rate(run->list_hits, run->list_misses));
+}
+
+/* ---------- Main ---------- */
+static GArray *parse_zooms(const char *spec) {
+    GArray *zooms = g_array_new(FALSE, FALSE, sizeof(float));
+    char **parts = g_strsplit(spec, ",", -1);
+    for (char **p = parts; *p; p++) {
+        float z = (float)g_ascii_strtod(*p, NULL);
+        if (z > 0) g_array_append_val(zooms, z);
+    }
+    g_strfreev(parts);
+    return zooms;
+}
+
+static void bench_document(const char *path, GArray *zooms, int max_pages, int repeat, int *first) {
+    fz_document *doc = NULL;
+    int pages = 0;
+
+    fz_try(ctx) {
+        doc = fz_open_document(ctx, path);
+        pages = fz_count_pages(ctx, doc);
+    } fz_catch(ctx) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, fz_caught_message(ctx));
+        fz_drop_document(ctx, doc);
+        return;
+    }
+    if (max_pages > 0) pages = MIN(pages, max_pages);
+
+    printf("%s    { \"path\": ", *first ? "" : ",\n");
+    json_string(path);
+    printf(", \"pages\": %d, \"runs\": [\n", pages);
+    *first = 0;
+
+    for (guint z = 0; z < zooms->len; z++) {
+        bench_run run = { .zoom = g_array_index(zooms, float, z) };
+        run.latency_ms = g_array_new(FALSE, FALSE, sizeof(double));
+
+        render_stats before, after;
+        render_get_stats(&before);
+        gint64 start = g_get_monotonic_time();
+        for (int r = 0; r < repeat; r++)
+            for (int p = 0; p < pages; p++)
+                request_page(doc, p, run.zoom, &run);
+        run.wall_ms = (g_get_monotonic_time() - start) / 1000.0;
+        render_get_stats(&after);
+
+        run.page_hits   = after.page_hits - before.page_hits;
+        run.page_misses = after.page_misses - before.page_misses;
+        run.list_hits   = after.list_hits - before.list_hits;
+        run.list_misses = after.list_misses - before.list_misses;
+
+        print_run(&run);
+        printf("%s\n", z + 1 < zooms->len ? "," : "");
+        g_array_free(run.latency_ms, TRUE);
+    }
+    printf("      ] }");
+
+    // Each document starts cold, as it would when opened in the viewer.
+    page_cache_clear();
+    list_cache_clear();
+    fz_drop_document(ctx, doc);
+}
+
+int main(int argc, char **argv) {
+    char *zoom_spec = NULL;
+    int max_pages = 0, repeat = 1, cache_mb = 0;
+    gboolean draft = FALSE;
+    GOptionEntry entries[] = {
+        { "zoom",     0, 0, G_OPTION_ARG_STRING, &zoom_spec, "Comma-separated zoom levels (default 1,2,4)", "LIST" },
+        { "pages",    0, 0, G_OPTION_ARG_INT,    &max_pages, "Only the first N pages of each file", "N" },
+        { "repeat",   0, 0, G_OPTION_ARG_INT,    &repeat,    "Request every page R times per zoom", "R" },
+        { "cache-mb", 0, 0, G_OPTION_ARG_INT,    &cache_mb,  "Memory budget for MuPDF and the page cache, in megabytes", "MB" },
+        { "draft",    0, 0, G_OPTION_ARG_NONE,   &draft,     "Render with the draft quality profile the viewer uses while scrolling", NULL },
+        { NULL },
+    };
+    GOptionContext *opts = g_option_context_new("FILE...");
+    g_option_context_add_main_entries(opts, entries, NULL);
+    GError *err = NULL;
+    if (!g_option_context_parse(opts, &argc, &argv, &err) || argc < 2) {
+        fprintf(stderr, "%s\n", err ? err->message : "No input files");
+        g_clear_error(&err);
+        g_option_context_free(opts);
+        return 2;
+    }
+    g_option_context_free(opts);
+
+    GArray *zooms = parse_zooms(zoom_spec ? zoom_spec : "1,2,4");
+    if (repeat < 1) repeat = 1;
+    if (draft) quality = RENDER_QUALITY_DRAFT;
+    const char *direct_env = g_getenv("GUF_DIRECT_RENDER");
+    if (direct_env && atoi(direct_env) == 0) direct_render = 0;
+
+    convert_init();
+    page_cache_init(NULL);
+    if (cache_mb > 0) cache_budget = (size_t)cache_mb << 20;
+
+    ctx = fz_new_context(&render_alloc, &render_locks, store_limit());
+    if (!ctx) {
+        fprintf(stderr, "Cannot create MuPDF context\n");
+        return 1;
+    }
+    fz_register_document_handlers(ctx);
+    render_pool_start(ctx, bench_job_done);
+
+    printf("{\n  \"direct_render\": %s, \"convert_kernel\": \"%s\", \"cache_mb\": %zu, \"repeat\": %d,\n",
+           direct_render ? "true" : "false", convert_kernel_name(), cache_budget >> 20, repeat);
+    printf("  \"quality\": \"%s\",\n", draft ? "draft" : "full");
+    printf("  \"documents\": [\n");
+    int first = 1;
+    for (int i = 1; i < argc; i++)
+        bench_document(argv[i], zooms, max_pages, repeat, &first);
+    printf("\n  ],\n");
+
+    render_pool_stop();
+    fz_drop_context(ctx);
+
+    render_stats st;
+    render_get_stats(&st);
+    printf("  \"buffer_pool\": { \"reused\": %u, \"allocated\": %u, \"idle_kb\": %zu },\n",
+           st.pool_hits, st.pool_misses, st.pool_idle_bytes >> 10);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("  \"peak_rss_kb\": %ld\n}\n", usage.ru_maxrss);
+
+    g_array_free(zooms, TRUE);
+    g_free(zoom_spec);
+    return 0;
+}
@@ -2,12 +2,19 @@
 #include <gtk/gtk.h>
 #include <gdk/gdk.h>
 #include <mupdf/fitz.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <mupdf/pdf.h>
 #include <math.h>
 
+#include "convert.h"
+#include "doccache.h"
+#include "docstream.h"
+#include "render.h"
+
 // MuPDF internal helper for text selection
 extern char *fz_copy_selection_from_stext_page(fz_context *ctx, fz_stext_page *page, fz_rect rect);
 
@@ -16,14 +23,24 @@ static fz_context  *ctx              = NULL;
 static fz_document *doc              = NULL;
 static char        *current_path     = NULL;
 static int          page_count       = 0;
+static int          page_count_known = 0;    // 0 while an open is still counting
+static int          doc_opening      = 0;
 static int          current_page     = 0;
 static float        zoom_factor      = 1.0f;
 static int          bookmark_page    = -1;
 
 /* ---------- Drawing Globals ---------- */
 static cairo_surface_t *page_surface = NULL;
-static unsigned char   *page_pixels  = NULL;
+static GdkTexture      *page_texture = NULL;      // page_surface as the page view draws it
+static int              page_surface_page = -1;   // page and zoom page_surface was rendered at;
+static float            page_surface_zoom = 0.0f; // it is scaled when they differ from the view
 static int              page_w, page_h;
+static int              continuous = 0;           // all pages stacked in one scrolling column
+static double           device_scale = 1.0;       // device pixels per logical pixel of the page view
+static int              fast_scrolling = 0;       // renders drop to logical resolution meanwhile
+static int              scroll_lowres = 1;        // GUF_SCROLL_LOWRES=0 keeps full density
+static int              interacting = 0;          // scrolling in progress: draft quality renders
+static int              draft_renders = 1;        // GUF_DRAFT=0 renders at full quality throughout
 
 /* ---------- Text Selection Globals ---------- */
 static int              selecting = 0;
@@ -32,21 +49,72 @@ static double           initial_drag_y = 0.0;
 static fz_point         selection_start_pt = { 0, 0 };
 static fz_point         selection_end_pt = { 0, 0 };
 static fz_rect          selection_rect = { 0, 0, 0, 0 };
+static GArray          *selection_lines = NULL; // line boxes under the drag, live
 
 /* ---------- Widgets ---------- */
 static GtkWidget *drawing_area;
 static GtkWidget *page_label;
+static GtkWidget *hud_label;
 static GtkWidget *bookmark_btn;
-static char *initial_file = NULL;
+static GtkWidget *layout_btn;
+static GtkWidget *fit_btn;
+static GtkWidget *search_bar;
+static GtkWidget *search_entry;
+static GtkWidget *search_label;
+static GtkWidget *main_window = NULL;
+static int        daemon_mode = 0;   // --daemon: stay up with the window hidden
+static int        shutting_down = 0; // the window is gone; late results are dropped
+static char **initial_files = NULL;   // from the command line, opened by activate
 
 /* ---------- Forward Declarations ---------- */
 void on_drag_begin(GtkGestureDrag *gesture, double x, double y, gpointer data);
 void on_drag_update(GtkGestureDrag *gesture, double offset_x, double offset_y, gpointer data);
 void on_drag_end(GtkGestureDrag *gesture, double velocity_x, double velocity_y, gpointer data);
+static void update_ui(void);
+static void page_view_set_content_size(GtkWidget *widget, int w, int h);
+static void thumb_strip_follow(void);
+static int page_view_rect(int page, double *ox, double *oy, double *pw, double *ph);
+static void scroll_to_page(int page);
+static void tab_open(const char *path);
+static void build_window(GtkApplication *app);
 
 /* ---------- Helpers ---------- */
+// Pixels per point renders are made at: zoom_factor in device pixels, so
+// HiDPI screens get sharp pages, or one pixel per logical pixel while
+// the continuous view scrolls fast. Cache keys and jobs use this; layout
+// and hit testing stay in logical pixels at zoom_factor.
+static float render_zoom(void) {
+    return zoom_factor * (float)(fast_scrolling ? MIN(device_scale, 1.0) : device_scale);
+}
+
+// The size a render is drawn at in the page view: its pixels over the
+// device scale it was tagged with when queued.
+static double surface_logical_width(cairo_surface_t *surface) {
+    double sx, sy;
+    cairo_surface_get_device_scale(surface, &sx, &sy);
+    return cairo_image_surface_get_width(surface) / sx;
+}
+
+static double surface_logical_height(cairo_surface_t *surface) {
+    double sx, sy;
+    cairo_surface_get_device_scale(surface, &sx, &sy);
+    return cairo_image_surface_get_height(surface) / sy;
+}
+
+// Documents are named by a local path, or by a URI for anything GIO can
+// reach that is not a local file.
+static int is_remote(const char *location) {
+    char *scheme = location ? g_uri_parse_scheme(location) : NULL;
+    g_free(scheme);
+    return scheme != NULL;
+}
+
+static char *file_location(GFile *file) {
+    return g_file_is_native(file) ? g_file_get_path(file) : g_file_get_uri(file);
+}
+
 static char *bookmark_path(const char *pdf) {
-    return pdf ? g_strdup_printf("%s.bookmark", pdf) : NULL;
+    return pdf && !is_remote(pdf) ? g_strdup_printf("%s.bookmark", pdf) : NULL;
 }
 
 static void load_bookmark(void) {
@@ -77,18 +145,14 @@ static void save_bookmark(void) {
 
 static fz_point screen_to_pdf(double screen_x, double screen_y) {
     fz_point pt = {0.0f, 0.0f};
-    if (!drawing_area || !doc) return pt;
-
-    double drawing_w = gtk_widget_get_width(drawing_area);
-    double drawing_h = gtk_widget_get_height(drawing_area);
-    double ox = (drawing_w > page_w) ? (drawing_w - page_w) / 2.0 : 0.0;
-    double oy = (drawing_h > page_h) ? (drawing_h - page_h) / 2.0 : 0.0;
+    double ox, oy, pw, ph;
+    if (!page_view_rect(current_page, &ox, &oy, &pw, &ph)) return pt;
 
     double page_x = screen_x - ox;
     double page_y = screen_y - oy;
 
-    page_x = fmax(0, fmin(page_w, page_x));
-    page_y = fmax(0, fmin(page_h, page_y));
+    page_x = fmax(0, fmin(pw, page_x));
+    page_y = fmax(0, fmin(ph, page_y));
 
     if (zoom_factor > 0) {
         pt.x = (float)(page_x / zoom_factor);
@@ -97,330 +161,3161 @@ static fz_point screen_to_pdf(double screen_x, double screen_y) {
     return pt;
 }
 
-// --- NEW HELPER: Reset Scroll to Top-Left ---
-static void reset_scroll_view(void) {
-    if (!drawing_area) return;
-    GtkWidget *sc = gtk_widget_get_ancestor(drawing_area, GTK_TYPE_SCROLLED_WINDOW);
-    if (!sc) return;
+// Set while the viewer moves the view itself (page turns, relayout, search
+// hits), so only the user's own scrolling counts as interaction.
+static int programmatic_scroll = 0;
+
+static void set_scroll_value(GtkAdjustment *adj, double value) {
+    programmatic_scroll++;
+    gtk_adjustment_set_value(adj, value);
+    programmatic_scroll--;
+}
+
+// --- NEW HELPER: Reset Scroll to Top-Left ---
+static void reset_scroll_view(void) {
+    if (!drawing_area) return;
+    if (continuous) {
+        scroll_to_page(current_page);
+        return;
+    }
+    GtkWidget *sc = gtk_widget_get_ancestor(drawing_area, GTK_TYPE_SCROLLED_WINDOW);
+    if (!sc) return;
+
+    GtkAdjustment *vadj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(sc));
+    GtkAdjustment *hadj = gtk_scrolled_window_get_hadjustment(GTK_SCROLLED_WINDOW(sc));
+
+    if (vadj) set_scroll_value(vadj, 0.0);
+    if (hadj) set_scroll_value(hadj, 0.0);
+}
+
+/* ---------- Page Textures ---------- */
+// Each page cache entry carries the GdkTexture the page view draws it with,
+// made on first use, so GSK uploads a render once rather than on every
+// frame.
+
+// Wraps the surface's pixels without copying: GDK_MEMORY_DEFAULT is
+// Cairo's ARGB32 layout, and the texture keeps the surface alive for as
+// long as the renderer holds on to it. Surfaces are never drawn into again
+// once rendered, so the two stay in step.
+static GdkTexture *texture_from_surface(cairo_surface_t *surface) {
+    cairo_surface_flush(surface);
+    int h      = cairo_image_surface_get_height(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    GBytes *bytes = g_bytes_new_with_free_func(cairo_image_surface_get_data(surface), (gsize)stride * h,
+                                               (GDestroyNotify)cairo_surface_destroy,
+                                               cairo_surface_reference(surface));
+    GdkTexture *texture = gdk_memory_texture_new(cairo_image_surface_get_width(surface), h,
+                                                 GDK_MEMORY_DEFAULT, bytes, stride);
+    g_bytes_unref(bytes);
+    return texture;
+}
+
+// The texture of surface if it is the one cached under key, else NULL.
+// Borrowed; does not touch the LRU order.
+static GdkTexture *page_cache_texture(cache_key key, cairo_surface_t *surface) {
+    gpointer *slot = surface ? page_cache_attachment(key, surface) : NULL;
+    if (!slot) return NULL;
+    if (!*slot) *slot = texture_from_surface(surface);
+    return *slot;
+}
+
+// Like page_cache_peek(), but the entry's texture.
+static GdkTexture *page_cache_peek_texture(cache_key key) {
+    return page_cache_texture(key, page_cache_peek(key));
+}
+
+/* ---------- Instrumentation ---------- */
+// The HUD next to the page label (H, or GUF_HUD=1) shows where the last
+// render of the current page spent its time, and GUF_TRACE=FILE ("-" for
+// stderr) logs every finished job and navigation as one JSON object per
+// line. A navigation runs from the input that changed the view to the end
+// of the first frame that shows the new view at full resolution.
+static FILE         *trace_file      = NULL;
+static gint64        trace_epoch     = 0;
+static int           hud_shown       = 0;
+static render_timing hud_timing;            // last render of the current page
+static gint64        hud_snapshot_us = 0;   // last page view snapshot
+static gint64        hud_nav_us      = -1;  // last input-to-pixels latency
+static gint64        nav_start       = 0;   // input not on screen yet, or 0
+static const char   *nav_what        = NULL;
+static int           nav_drawn       = 0;   // the last snapshot showed it
+
+static const char *job_kind_names[] = { "render", "text", "thumb" };
+
+static double us_to_ms(gint64 us) {
+    return us / 1000.0;
+}
+
+static void trace_open(const char *spec) {
+    if (!spec || !*spec) return;
+    trace_file = strcmp(spec, "-") == 0 ? stderr : fopen(spec, "w");
+    if (!trace_file) fprintf(stderr, "Cannot open trace file %s\n", spec);
+    trace_epoch = g_get_monotonic_time();
+}
+
+// Writes { "t_ms", "event", then the "key": value pairs in fields }.
+static void trace_event(const char *event, const char *fields, ...) {
+    if (!trace_file) return;
+    va_list ap;
+    va_start(ap, fields);
+    fprintf(trace_file, "{\"t_ms\": %.3f, \"event\": \"%s\", ",
+            us_to_ms(g_get_monotonic_time() - trace_epoch), event);
+    vfprintf(trace_file, fields, ap);
+    fputs("}\n", trace_file);
+    fflush(trace_file);
+    va_end(ap);
+}
+
+static void hud_update(void) {
+    if (!hud_shown) return;
+    render_stats st;
+    render_get_stats(&st);
+    guint lookups = st.page_hits + st.page_misses;
+
+    char nav[32] = "-";
+    if (hud_nav_us >= 0) snprintf(nav, sizeof(nav), "%.0f", us_to_ms(hud_nav_us));
+
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "LOAD %.1f  LIST %.1f  RASTER %.1f  CONV %.1f  SURF %.1f  DRAW %.1f MS  |  "
+             "HIT %u%%  QUEUE %d  |  INPUT>PIXELS %s MS",
+             us_to_ms(hud_timing.load_us), us_to_ms(hud_timing.list_us), us_to_ms(hud_timing.raster_us),
+             us_to_ms(hud_timing.convert_us), us_to_ms(hud_timing.surface_us), us_to_ms(hud_snapshot_us),
+             lookups ? st.page_hits * 100 / lookups : 0, render_queue_depth(), nav);
+    gtk_label_set_text(GTK_LABEL(hud_label), buf);
+}
+
+static void on_toggle_hud(GtkWidget *w, gpointer data) {
+    hud_shown = !hud_shown;
+    gtk_widget_set_visible(hud_label, hud_shown);
+    hud_update();
+}
+
+// Starts timing a navigation; a newer input restarts it, since the views
+// it skipped never reach the screen.
+static void nav_begin(const char *what) {
+    nav_start = g_get_monotonic_time();
+    nav_what  = what;
+    nav_drawn = 0;
+}
+
+// Called once the page view's frame has been painted.
+static void on_after_paint(GdkFrameClock *clock, gpointer data) {
+    if (!nav_drawn) return;
+    hud_nav_us = g_get_monotonic_time() - nav_start;
+    trace_event("nav", "\"what\": \"%s\", \"page\": %d, \"zoom\": %.3f, \"latency_ms\": %.3f, "
+                "\"draw_ms\": %.3f, \"queue\": %d",
+                nav_what, current_page, zoom_factor, us_to_ms(hud_nav_us),
+                us_to_ms(hud_snapshot_us), render_queue_depth());
+    nav_start = 0;
+    nav_drawn = 0;
+    hud_update();
+}
+
+static void on_view_realize(GtkWidget *widget, gpointer data) {
+    g_signal_connect(gtk_widget_get_frame_clock(widget), "after-paint", G_CALLBACK(on_after_paint), NULL);
+}
+
+static void trace_job(render_job *job) {
+    if (job->kind == JOB_RENDER && job->surface && job->doc == doc && job->page == current_page &&
+        !job->preview) {
+        hud_timing = job->timing;
+        hud_update();
+    }
+    if (!trace_file) return;
+
+    render_stats st;
+    render_get_stats(&st);
+    const render_timing *t = &job->timing;
+    trace_event("job", "\"kind\": \"%s\", \"page\": %d, \"zoom\": %.3f, \"tile\": [%d, %d], "
+                "\"priority\": %d, \"prefetch\": %d, \"preview\": %d, \"aborted\": %d, \"failed\": %d, "
+                "\"wait_ms\": %.3f, \"load_ms\": %.3f, \"list_ms\": %.3f, \"list_hit\": %d, "
+                "\"surface_ms\": %.3f, \"raster_ms\": %.3f, \"convert_ms\": %.3f, "
+                "\"queue\": %d, \"page_hits\": %u, \"page_misses\": %u",
+                job_kind_names[job->kind], job->page, job->zoom, job->key.tx, job->key.ty,
+                job->priority, job->prefetch, job->preview, job->cookie.abort, job->failed,
+                us_to_ms(t->wait_us), us_to_ms(t->load_us), us_to_ms(t->list_us), t->list_hit,
+                us_to_ms(t->surface_us), us_to_ms(t->raster_us), us_to_ms(t->convert_us),
+                render_queue_depth(), st.page_hits, st.page_misses);
+}
+
+/* ---------- Text Page Cache ---------- */
+// Structured text for recently shown pages, so a copy only has to walk the
+// lines. A page's text is extracted in the background once the page is on
+// screen, and sooner when a selection on it needs it. Main thread only.
+#define TEXT_CACHE_PAGES 16
+#define TEXT_GRID_CELL   32.0f   // points, grown on pages too big for the cap
+#define TEXT_GRID_MAX    256     // cells per side
+
+// Each page's text lines are bucketed into a uniform grid (stored CSR-style:
+// cell c owns items[start[c] .. start[c+1])), so a selection only tests the
+// lines in the cells it covers.
+typedef struct text_page {
+    int             page;
+    fz_stext_page  *stext;
+    GList           link;
+
+    int             nlines;
+    fz_stext_line **lines;      // in reading order
+    fz_rect         bounds;     // union of all line boxes, clipped to the page
+    float           cell_w, cell_h;
+    int             cols, rows;
+    int            *cell_start;
+    int            *cell_items; // indices into lines
+    guint          *stamp;      // per line, dedupes lines spanning cells
+    guint           query;
+} text_page;
+
+static GQueue      text_lru     = G_QUEUE_INIT;
+static GHashTable *text_pending = NULL;   // page -> its JOB_TEXT in flight
+
+static void text_page_free(text_page *t) {
+    fz_drop_stext_page(ctx, t->stext);
+    g_free(t->lines);
+    g_free(t->cell_start);
+    g_free(t->cell_items);
+    g_free(t->stamp);
+    g_free(t);
+}
+
+static int rect_intersects_selection(fz_rect r1, fz_rect r2) {
+    if (r1.x1 <= r2.x0 || r1.x0 >= r2.x1) return 0;
+    if (r1.y1 <= r2.y0 || r1.y0 >= r2.y1) return 0;
+    return 1;
+}
+
+// Clamps before converting, so boxes far off the page stay defined.
+static int text_cell(float v, float origin, float cell, int n) {
+    float c = floorf((v - origin) / cell);
+    return c < 0 ? 0 : c >= n ? n - 1 : (int)c;
+}
+
+static void text_cell_range(text_page *t, fz_rect r, int *cx0, int *cy0, int *cx1, int *cy1) {
+    *cx0 = text_cell(r.x0, t->bounds.x0, t->cell_w, t->cols);
+    *cy0 = text_cell(r.y0, t->bounds.y0, t->cell_h, t->rows);
+    *cx1 = MAX(text_cell(r.x1, t->bounds.x0, t->cell_w, t->cols), *cx0);
+    *cy1 = MAX(text_cell(r.y1, t->bounds.y0, t->cell_h, t->rows), *cy0);
+}
+
+// Malformed pages can have line boxes that are NaN or infinite; such lines
+// stay out of the grid and can never be selected.
+static int text_line_gridded(const fz_stext_line *line) {
+    fz_rect r = line->bbox;
+    return isfinite(r.x0) && isfinite(r.y0) && isfinite(r.x1) && isfinite(r.y1) &&
+           r.x0 <= r.x1 && r.y0 <= r.y1;
+}
+
+static void text_index_build(text_page *t) {
+    int n = 0;
+    t->bounds = fz_empty_rect;
+    for (fz_stext_block *block = t->stext->first_block; block; block = block->next) {
+        if (block->type != FZ_STEXT_BLOCK_TEXT) continue;
+        for (fz_stext_line *line = block->u.t.first_line; line; line = line->next) {
+            if (text_line_gridded(line)) t->bounds = fz_union_rect(t->bounds, line->bbox);
+            n++;
+        }
+    }
+    // A stray huge line would otherwise size the grid.
+    if (!fz_is_empty_rect(t->stext->mediabox))
+        t->bounds = fz_intersect_rect(t->bounds, t->stext->mediabox);
+    if (fz_is_empty_rect(t->bounds)) n = 0;
+
+    float w = n ? t->bounds.x1 - t->bounds.x0 : 0;
+    float h = n ? t->bounds.y1 - t->bounds.y0 : 0;
+    t->nlines = n;
+    t->lines  = g_new(fz_stext_line *, MAX(n, 1));
+    t->stamp  = g_new0(guint, MAX(n, 1));
+    t->cell_w = fmaxf(TEXT_GRID_CELL, w / TEXT_GRID_MAX);
+    t->cell_h = fmaxf(TEXT_GRID_CELL, h / TEXT_GRID_MAX);
+    t->cols   = CLAMP((int)ceilf(w / t->cell_w), 1, TEXT_GRID_MAX);
+    t->rows   = CLAMP((int)ceilf(h / t->cell_h), 1, TEXT_GRID_MAX);
+
+    int ncells = t->cols * t->rows;
+    t->cell_start = g_new0(int, ncells + 1);
+
+    // Count pass, then prefix sums, then fill.
+    int i = 0;
+    for (fz_stext_block *block = t->stext->first_block; block; block = block->next) {
+        if (block->type != FZ_STEXT_BLOCK_TEXT) continue;
+        for (fz_stext_line *line = block->u.t.first_line; line && i < n; line = line->next) {
+            int cx0, cy0, cx1, cy1;
+            t->lines[i++] = line;
+            if (!text_line_gridded(line)) continue;
+            text_cell_range(t, line->bbox, &cx0, &cy0, &cx1, &cy1);
+            for (int cy = cy0; cy <= cy1; cy++)
+                for (int cx = cx0; cx <= cx1; cx++)
+                    t->cell_start[cy * t->cols + cx + 1]++;
+        }
+    }
+    for (int c = 0; c < ncells; c++)
+        t->cell_start[c + 1] += t->cell_start[c];
+
+    int *fill = g_memdup2(t->cell_start, ncells * sizeof(int));
+    t->cell_items = g_new(int, MAX(t->cell_start[ncells], 1));
+    for (i = 0; i < n; i++) {
+        int cx0, cy0, cx1, cy1;
+        if (!text_line_gridded(t->lines[i])) continue;
+        text_cell_range(t, t->lines[i]->bbox, &cx0, &cy0, &cx1, &cy1);
+        for (int cy = cy0; cy <= cy1; cy++)
+            for (int cx = cx0; cx <= cx1; cx++)
+                t->cell_items[fill[cy * t->cols + cx]++] = i;
+    }
+    g_free(fill);
+}
+
+static int compare_int(gconstpointer a, gconstpointer b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Appends the index of every line whose box overlaps r to out, in reading
+// order.
+static void text_page_query(text_page *t, fz_rect r, GArray *out) {
+    if (!t->nlines || r.x1 <= t->bounds.x0 || r.x0 >= t->bounds.x1 ||
+        r.y1 <= t->bounds.y0 || r.y0 >= t->bounds.y1)
+        return;
+
+    if (++t->query == 0) {
+        memset(t->stamp, 0, t->nlines * sizeof(guint));
+        t->query = 1;
+    }
+
+    guint first = out->len;
+    int cx0, cy0, cx1, cy1;
+    text_cell_range(t, r, &cx0, &cy0, &cx1, &cy1);
+    for (int cy = cy0; cy <= cy1; cy++) {
+        for (int cx = cx0; cx <= cx1; cx++) {
+            int c = cy * t->cols + cx;
+            for (int k = t->cell_start[c]; k < t->cell_start[c + 1]; k++) {
+                int i = t->cell_items[k];
+                if (t->stamp[i] == t->query) continue;
+                t->stamp[i] = t->query;
+                if (rect_intersects_selection(t->lines[i]->bbox, r))
+                    g_array_append_val(out, i);
+            }
+        }
+    }
+    if (out->len - first > 1)
+        qsort(&g_array_index(out, int, first), out->len - first, sizeof(int), compare_int);
+}
+
+static text_page *text_cache_find(int page) {
+    for (GList *l = text_lru.head; l; l = l->next) {
+        text_page *t = l->data;
+        if (t->page == page) {
+            g_queue_unlink(&text_lru, &t->link);
+            g_queue_push_head_link(&text_lru, &t->link);
+            return t;
+        }
+    }
+    return NULL;
+}
+
+// Takes ownership of stext.
+static text_page *text_cache_insert(int page, fz_stext_page *stext) {
+    text_page *t = text_cache_find(page);
+    if (t) {
+        fz_drop_stext_page(ctx, stext);
+        return t;
+    }
+
+    t = g_new0(text_page, 1);
+    t->page      = page;
+    t->stext     = stext;
+    t->link.data = t;
+    text_index_build(t);
+    g_queue_push_head_link(&text_lru, &t->link);
+
+    while (text_lru.length > TEXT_CACHE_PAGES) {
+        text_page *old = text_lru.tail->data;
+        g_queue_unlink(&text_lru, &old->link);
+        text_page_free(old);
+    }
+    return t;
+}
+
+static void text_cache_clear(void) {
+    text_page *t;
+    while ((t = g_queue_peek_tail(&text_lru))) {
+        g_queue_unlink(&text_lru, &t->link);
+        text_page_free(t);
+    }
+    if (text_pending) g_hash_table_remove_all(text_pending);
+}
+
+static void queue_text_job(int page) {
+    if (!doc || text_cache_find(page) || g_hash_table_contains(text_pending, GINT_TO_POINTER(page)))
+        return;
+
+    render_job *job = g_new0(render_job, 1);
+    job->kind     = JOB_TEXT;
+    job->page     = page;
+    job->key      = make_cache_key(page, 0.0f);
+    job->priority = JOB_PRIO_TEXT;
+    job->doc      = fz_keep_document(ctx, doc);
+    g_hash_table_insert(text_pending, GINT_TO_POINTER(page), job);
+    render_queue_push(job);
+}
+
+// Wants the page's text soon: its job, queued or not, jumps to visible
+// priority. Extraction stays on the workers; the UI waits for
+// text_job_done() rather than doing it inline under doc_lock.
+static void text_page_request(int page) {
+    queue_text_job(page);
+    render_job *job = g_hash_table_lookup(text_pending, GINT_TO_POINTER(page));
+    if (job) render_job_promote(job, JOB_PRIO_VISIBLE);
+}
+
+static void selection_text_ready(int page, text_page *text);
+
+static void text_job_done(render_job *job) {
+    if (job->doc != doc) return;
+    if (g_hash_table_lookup(text_pending, GINT_TO_POINTER(job->page)) == job)
+        g_hash_table_remove(text_pending, GINT_TO_POINTER(job->page));
+    text_page *text = NULL;
+    if (job->stext) {
+        text = text_cache_insert(job->page, job->stext);
+        job->stext = NULL;
+    }
+    selection_text_ready(job->page, text);
+}
+
+/* ---------- Thumbnails ---------- */
+// One slot per page for the sidebar strip. Pixels stay compact once
+// rendered; a texture is only made while the row is on screen. Rows are
+// requested as the strip scrolls, at the lowest priority so they only ever
+// use idle workers.
+typedef struct thumb {
+    guint16    *pixels;     // RGB565, NULL until rendered
+    int         w, h;
+    GdkTexture *texture;
+} thumb;
+
+static thumb      *thumbs        = NULL;
+static int         thumbs_n      = 0;
+static size_t      thumb_bytes   = 0;
+static int         thumbs_unsaved = 0;     // rendered since the cache file was read
+static GHashTable *thumb_pending = NULL;   // page -> render_job
+static int         thumb_tex_first = 0;    // rows that may hold a texture
+static int         thumb_tex_last  = -1;
+
+static void thumbs_reset(int count) {
+    for (int i = 0; i < thumbs_n; i++) {
+        g_free(thumbs[i].pixels);
+        if (thumbs[i].texture) g_object_unref(thumbs[i].texture);
+    }
+    g_free(thumbs);
+    thumbs   = count > 0 ? g_new0(thumb, count) : NULL;
+    thumbs_n = count;
+    thumb_bytes = 0;
+    thumbs_unsaved = 0;
+    thumb_tex_first = 0;
+    thumb_tex_last  = -1;
+    g_atomic_int_inc(&thumb_generation);    // queued and running jobs are dropped
+    g_hash_table_remove_all(thumb_pending);
+}
+
+// Expands to RGB8 for upload; only the rows on screen pay for this.
+static GdkTexture *thumb_texture(int page) {
+    thumb *t = &thumbs[page];
+    if (t->texture || !t->pixels) return t->texture;
+
+    guint8 *rgb = g_malloc((size_t)t->w * t->h * 3);
+    for (int i = 0; i < t->w * t->h; i++) {
+        guint16 v = t->pixels[i];
+        guint8 r = v >> 11, g = (v >> 5) & 0x3f, b = v & 0x1f;
+        rgb[3 * i]     = (r << 3) | (r >> 2);
+        rgb[3 * i + 1] = (g << 2) | (g >> 4);
+        rgb[3 * i + 2] = (b << 3) | (b >> 2);
+    }
+    GBytes *bytes = g_bytes_new_take(rgb, (gsize)t->w * t->h * 3);
+    t->texture = gdk_memory_texture_new(t->w, t->h, GDK_MEMORY_R8G8B8, bytes, (gsize)t->w * 3);
+    g_bytes_unref(bytes);
+    return t->texture;
+}
+
+// Drops the textures of rows that left [first, last].
+static void thumb_textures_keep(int first, int last) {
+    for (int p = thumb_tex_first; p <= thumb_tex_last && p < thumbs_n; p++) {
+        if ((p < first || p > last) && thumbs[p].texture) {
+            g_object_unref(thumbs[p].texture);
+            thumbs[p].texture = NULL;
+        }
+    }
+    thumb_tex_first = first;
+    thumb_tex_last  = last;
+}
+
+static int thumb_load_cached(int page);
+
+static void queue_thumb_job(int page, gint generation) {
+    render_job *job = g_new0(render_job, 1);
+    job->kind       = JOB_THUMB;
+    job->page       = page;
+    job->key        = make_cache_key(page, 0.0f);
+    job->priority   = JOB_PRIO_THUMB;
+    job->generation = generation;
+    job->doc        = fz_keep_document(ctx, doc);
+    g_hash_table_insert(thumb_pending, GINT_TO_POINTER(page), job);
+    render_queue_push(job);
+}
+
+// Queues the rows in [first, last] that have no thumbnail yet. Jobs for
+// rows scrolled away go stale and are skipped or aborted.
+static void thumbs_request(int first, int last) {
+    if (!doc || !thumbs_n) return;
+    g_atomic_int_inc(&thumb_generation);
+    gint generation = g_atomic_int_get(&thumb_generation);
+
+    for (int p = MAX(first, 0); p <= MIN(last, thumbs_n - 1); p++) {
+        if (thumbs[p].pixels || thumb_load_cached(p)) continue;
+        render_job *pending = g_hash_table_lookup(thumb_pending, GINT_TO_POINTER(p));
+        if (pending && !pending->cookie.abort) {
+            g_atomic_int_set(&pending->generation, generation);
+            continue;
+        }
+        queue_thumb_job(p, generation);
+    }
+    render_cancel_stale();
+}
+
+static void thumb_strip_changed(void);
+
+static void thumb_job_done(render_job *job) {
+    int was_pending = g_hash_table_lookup(thumb_pending, GINT_TO_POINTER(job->page)) == job;
+    if (was_pending)
+        g_hash_table_remove(thumb_pending, GINT_TO_POINTER(job->page));
+    if (job->doc != doc || job->page >= thumbs_n) return;
+
+    // Skipped as stale, then taken back into view before the worker
+    // marked it: the row still wants its thumbnail.
+    if (was_pending && !job->thumb && !job->failed && !thumbs[job->page].pixels && !render_job_is_stale(job)) {
+        queue_thumb_job(job->page, job->generation);
+        return;
+    }
+
+    if (job->thumb && !thumbs[job->page].pixels) {
+        thumb *t = &thumbs[job->page];
+        t->pixels = job->thumb;
+        t->w = job->thumb_w;
+        t->h = job->thumb_h;
+        job->thumb = NULL;
+        thumb_bytes += (size_t)t->w * t->h * sizeof(guint16);
+        thumbs_unsaved++;
+        thumb_strip_changed();
+    }
+}
+
+/* ---------- PDF Rendering ---------- */
+// Jobs that have been queued but not yet posted back, keyed like the cache.
+static GHashTable *pending_jobs   = NULL;
+static int         read_direction = 1;
+static int         prefetch_depth = 3;
+static guint       prefetch_id    = 0;
+static guint       settle_id      = 0;
+static int         settle_dirty   = 0;  // a coalesced view change still needs its render
+
+// Page bounds in points, filled in as render jobs load pages.
+static fz_rect       *page_bounds       = NULL;
+static unsigned char *page_bounds_known = NULL;
+static int            page_tiled        = 0;
+
+// Whole-page previews are kept to about PREVIEW_MAX_BYTES so they come back
+// quickly; they are shown scaled until the sharp render or tiles land.
+#define PREVIEW_MAX_BYTES ((size_t)4 << 20)
+static cache_key preview_key = { -1, 0, -1, -1 };
+
+static void free_page_surface(void) {
+    if (page_texture) g_object_unref(page_texture);
+    if (page_surface) cairo_surface_destroy(page_surface);
+    page_texture = NULL;
+    page_surface = NULL;
+    page_surface_page = -1;
+}
+
+// Shares the cache entry's texture when the surface came from the cache,
+// so the same render is not uploaded twice.
+static void set_page_surface(cairo_surface_t *surface, int page, float zoom) {
+    GdkTexture *texture = page_cache_texture(make_cache_key(page, zoom), surface);
+    texture = texture ? g_object_ref(texture) : texture_from_surface(surface);
+    cairo_surface_reference(surface);
+    free_page_surface();
+    page_surface = surface;
+    page_texture = texture;
+    page_surface_page = page;
+    page_surface_zoom = zoom;
+}
+
+// Sizes the view for the current page and zoom: from the page's bounds when
+// known, otherwise by scaling whatever render of the page is on screen. A
+// surface of some other page keeps its own size until the new page lands.
+static void ensure_layout(void);
+static int  layout_w, layout_h;
+
+static void update_page_size(void) {
+    if (continuous && doc) {
+        ensure_layout();
+        page_w = layout_w;
+        page_h = layout_h;
+    } else if (page_bounds_known[current_page]) {
+        fz_irect bbox = page_pixel_bbox(page_bounds[current_page], zoom_factor);
+        page_w = bbox.x1 - bbox.x0;
+        page_h = bbox.y1 - bbox.y0;
+    } else if (page_surface && page_surface_page == current_page) {
+        double scale = zoom_factor / page_surface_zoom;
+        page_w = (int)lround(cairo_image_surface_get_width(page_surface) * scale);
+        page_h = (int)lround(cairo_image_surface_get_height(page_surface) * scale);
+    } else if (page_surface) {
+        page_w = (int)lround(surface_logical_width(page_surface));
+        page_h = (int)lround(surface_logical_height(page_surface));
+    }
+}
+
+static void reset_page_bounds(void) {
+    g_free(page_bounds);
+    g_free(page_bounds_known);
+    page_bounds       = g_new0(fz_rect, MAX(page_count, 1));
+    page_bounds_known = g_new0(unsigned char, MAX(page_count, 1));
+}
+
+static int is_current_view(cache_key key) {
+    return key.page == current_page && key.zoom == make_cache_key(current_page, render_zoom()).zoom;
+}
+
+static int draft_active(void) {
+    return interacting && draft_renders;
+}
+
+// Whether key's cached render will do: any render while the user is
+// scrolling, a full-quality one otherwise.
+static int have_render(cache_key key) {
+    return page_cache_contains(key) && (draft_active() || !page_cache_is_draft(key));
+}
+
+static render_job *queue_render_job(cache_key key, float zoom, int priority, int prefetch) {
+    render_job *job = g_new0(render_job, 1);
+    job->page       = key.page;
+    job->zoom       = zoom;
+    job->device_scale = zoom / zoom_factor;
+    job->key        = key;
+    job->priority   = priority;
+    job->quality    = draft_active() ? RENDER_QUALITY_DRAFT : RENDER_QUALITY_FULL;
+    job->prefetch   = prefetch;
+    job->generation = g_atomic_int_get(&render_generation);
+    job->doc        = fz_keep_document(ctx, doc);
+    // Replacing the key too: the old one lives in a job that may be freed first.
+    g_hash_table_replace(pending_jobs, &job->key, job);
+    render_queue_push(job);
+    return job;
+}
+
+// Carries a pending job that is still useful over into the current
+// generation so it is neither skipped nor aborted.
+static render_job *adopt_pending_job(cache_key key) {
+    render_job *job = g_hash_table_lookup(pending_jobs, &key);
+    if (!job || job->doc != doc || job->cookie.abort) return NULL;
+    if (job->quality == RENDER_QUALITY_DRAFT && !draft_active()) return NULL;
+    g_atomic_int_set(&job->generation, g_atomic_int_get(&render_generation));
+    return job;
+}
+
+// Asks for key as a visible render. A prefetch already pending for it is
+// moved ahead of the other prefetches if still queued, or left to finish
+// if a worker has it; otherwise a fresh visible job replaces it.
+static void queue_visible_job(cache_key key) {
+    render_job *pending = adopt_pending_job(key);
+    if (pending && render_job_promote(pending, JOB_PRIO_VISIBLE)) {
+        pending->prefetch = 0;
+        return;
+    }
+    if (pending) pending->cookie.abort = 1;
+    queue_render_job(key, render_zoom(), JOB_PRIO_VISIBLE, 0);
+}
+
+// The prefetch window: prefetch_depth pages in the reading direction, then
+// the page just behind. i runs from 1 to prefetch_depth + 1.
+static int prefetch_target(int i) {
+    return (i <= prefetch_depth) ? current_page + read_direction * i
+                                 : current_page - read_direction;
+}
+
+static void adopt_prefetch_window(void) {
+    for (int i = 1; i <= prefetch_depth + 1; i++)
+        adopt_pending_job(make_cache_key(prefetch_target(i), render_zoom()));
+}
+
+// Warms the cache with the pages around the reader. Runs at idle priority
+// once the visible page is up, and the jobs sort behind any visible-page
+// request. Pages known to need tiles are left alone.
+static gboolean prefetch_idle(gpointer data) {
+    prefetch_id = 0;
+    if (!doc) return G_SOURCE_REMOVE;
+
+    for (int i = 1; i <= prefetch_depth + 1; i++) {
+        int page = prefetch_target(i);
+        if (page < 0 || page >= page_count) continue;
+        if (page_bounds_known[page] &&
+            page_needs_tiles(page_pixel_bbox(page_bounds[page], render_zoom())))
+            continue;
+
+        cache_key key = make_cache_key(page, render_zoom());
+        if (have_render(key) || adopt_pending_job(key))
+            continue;
+        queue_render_job(key, render_zoom(), JOB_PRIO_PREFETCH + i, 1);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void schedule_prefetch(void) {
+    if (prefetch_depth <= 0 || prefetch_id) return;
+    prefetch_id = g_idle_add_full(G_PRIORITY_LOW, prefetch_idle, NULL, NULL);
+}
+
+// Tile index range covering the part of the page the scrolled window shows.
+static int visible_tiles(int page, int *tx0, int *ty0, int *tx1, int *ty1) {
+    GtkWidget *sc = gtk_widget_get_ancestor(drawing_area, GTK_TYPE_SCROLLED_WINDOW);
+    double ox, oy, pw, ph;
+    if (!sc || !page_view_rect(page, &ox, &oy, &pw, &ph) || pw <= 0 || ph <= 0) return 0;
+
+    GtkAdjustment *hadj = gtk_scrolled_window_get_hadjustment(GTK_SCROLLED_WINDOW(sc));
+    GtkAdjustment *vadj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(sc));
+
+    double x0 = gtk_adjustment_get_value(hadj) - ox;
+    double y0 = gtk_adjustment_get_value(vadj) - oy;
+    double x1 = x0 + gtk_adjustment_get_page_size(hadj);
+    double y1 = y0 + gtk_adjustment_get_page_size(vadj);
+
+    if (x1 <= 0 || y1 <= 0 || x0 >= pw || y0 >= ph) return 0;
+
+    // Tiles are TILE_SIZE render pixels square.
+    double s = render_zoom() / zoom_factor;
+    x0 *= s; y0 *= s; x1 *= s; y1 *= s; pw *= s; ph *= s;
+
+    int cols = ((int)pw + TILE_SIZE - 1) / TILE_SIZE;
+    int rows = ((int)ph + TILE_SIZE - 1) / TILE_SIZE;
+    *tx0 = CLAMP((int)floor(x0 / TILE_SIZE), 0, cols - 1);
+    *ty0 = CLAMP((int)floor(y0 / TILE_SIZE), 0, rows - 1);
+    *tx1 = CLAMP((int)ceil(x1 / TILE_SIZE) - 1, *tx0, cols - 1);
+    *ty1 = CLAMP((int)ceil(y1 / TILE_SIZE) - 1, *ty0, rows - 1);
+    return 1;
+}
+
+// Queues every visible tile that is not cached yet, plus a one-tile margin
+// at lower priority. Tiles already in flight are adopted, so the caller can
+// cancel whatever scrolled out of view.
+static void queue_visible_tiles(int page) {
+    int tx0, ty0, tx1, ty1;
+    if (!visible_tiles(page, &tx0, &ty0, &tx1, &ty1)) return;
+
+    float zoom = render_zoom();
+    fz_irect bbox = page_pixel_bbox(page_bounds[page], zoom);
+    int cols = (bbox.x1 - bbox.x0 + TILE_SIZE - 1) / TILE_SIZE;
+    int rows = (bbox.y1 - bbox.y0 + TILE_SIZE - 1) / TILE_SIZE;
+
+    for (int ty = MAX(ty0 - 1, 0); ty <= MIN(ty1 + 1, rows - 1); ty++) {
+        for (int tx = MAX(tx0 - 1, 0); tx <= MIN(tx1 + 1, cols - 1); tx++) {
+            cache_key key = make_tile_key(page, zoom, tx, ty);
+            if (have_render(key) || adopt_pending_job(key))
+                continue;
+            int margin = tx < tx0 || tx > tx1 || ty < ty0 || ty > ty1;
+            queue_render_job(key, zoom, JOB_PRIO_VISIBLE + margin, 0);
+        }
+    }
+}
+
+static void continuous_scrolled(void);
+static void render_visible_pages(void);
+static void render_current_page(void);
+
+// Scroll events closer together than INTERACTION_MS (a held key, a wheel
+// or touchpad in motion, a dragged scrollbar) mark the user as interacting:
+// what gets rendered meanwhile uses the draft profile, and INTERACTION_MS
+// after the last one the view is rendered again at full quality. A
+// single scroll step is rendered at full quality straight away.
+#define INTERACTION_MS 150
+
+static guint  interaction_id  = 0;
+static gint64 last_scroll_us  = 0;
+
+static gboolean interaction_ended(gpointer data) {
+    interaction_id = 0;
+    interacting = 0;
+    if (doc && (continuous || page_tiled)) {
+        g_atomic_int_inc(&render_generation);
+        if (continuous) {
+            render_visible_pages();
+        } else {
+            adopt_pending_job(preview_key);
+            queue_visible_tiles(current_page);
+        }
+        render_cancel_stale();
+    } else if (doc && page_surface && render_surface_is_draft(page_surface)) {
+        render_current_page();
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void note_scroll(void) {
+    gint64 now = g_get_monotonic_time();
+    if (now - last_scroll_us < INTERACTION_MS * 1000) interacting = 1;
+    last_scroll_us = now;
+    if (!interacting) return;
+    if (interaction_id) g_source_remove(interaction_id);
+    interaction_id = g_timeout_add(INTERACTION_MS, interaction_ended, NULL);
+}
+
+static void on_view_scrolled(GtkAdjustment *adj, gpointer data) {
+    // The page view only snapshots what is near the viewport, so a
+    // scrolled snapshot may be missing pages or tiles now in view.
+    if (doc && (continuous || page_tiled)) gtk_widget_queue_draw(drawing_area);
+    if (doc && continuous) {
+        // Inside a page/zoom burst (or just after its first render), the
+        // settled render covers wherever the column has scrolled to.
+        if (settle_id) {
+            settle_dirty = 1;
+            return;
+        }
+        continuous_scrolled();
+        return;
+    }
+    // While a page/zoom burst is settling, its final render queues the tiles.
+    if (!doc || !page_tiled || settle_dirty) return;
+    g_atomic_int_inc(&render_generation);
+    adopt_pending_job(preview_key);
+    queue_visible_tiles(current_page);
+    render_cancel_stale();
+}
+
+// Scrollbar, wheel, touchpad and key scrolling; the "changed" signals
+// (relayouts) and the viewer's own scrolls are not interaction.
+static void on_view_value_changed(GtkAdjustment *adj, gpointer data) {
+    if (doc && !programmatic_scroll) note_scroll();
+    on_view_scrolled(adj, data);
+}
+
+// Whether a render of the current page at zoom would look closer to the
+// view than what is on screen now.
+static int better_than_shown(float zoom) {
+    if (page_surface_page != current_page) return 1;
+    float target = render_zoom();
+    return fabs(log(zoom / target)) < fabs(log(page_surface_zoom / target));
+}
+
+static float preview_zoom(int page) {
+    float z = render_zoom() / 4.0f;
+    if (page_bounds_known[page]) {
+        fz_rect b = page_bounds[page];
+        double bytes = (double)(b.x1 - b.x0) * (b.y1 - b.y0) * 4.0;
+        if (bytes > 0) z = fminf(z, (float)sqrt(PREVIEW_MAX_BYTES / bytes));
+    }
+    return z;
+}
+
+// Puts the best cached picture of the current view on screen without
+// queueing any work: the exact render if there is one (returns 1), else the
+// closest render of the page at another zoom, scaled.
+static int show_cached_view(void) {
+    if (continuous) {
+        page_tiled = 0;
+        update_page_size();
+        return 0;
+    }
+    float zoom = render_zoom();
+    page_tiled = page_bounds_known[current_page] &&
+                 page_needs_tiles(page_pixel_bbox(page_bounds[current_page], zoom));
+
+    cache_key key = make_cache_key(current_page, zoom);
+    cairo_surface_t *cached = page_tiled ? NULL : page_cache_lookup(key);
+    if (cached) {
+        set_page_surface(cached, current_page, zoom);
+    } else {
+        float found_zoom;
+        cairo_surface_t *closest = page_cache_closest(current_page, zoom, &found_zoom);
+        if (closest && better_than_shown(found_zoom))
+            set_page_surface(closest, current_page, found_zoom);
+    }
+    update_page_size();
+    // A draft is shown, but the full-quality render is still wanted.
+    return cached != NULL && have_render(key);
+}
+
+// Queues a quick low-resolution render ahead of the sharp one unless
+// something on screen is already at least that good.
+static void request_preview(void) {
+    float pz = preview_zoom(current_page);
+    if (pz > render_zoom() * 0.5f) return;
+    if (page_surface_page == current_page && page_surface_zoom >= pz) return;
+
+    preview_key = make_cache_key(current_page, pz);
+    if (page_cache_contains(preview_key) || adopt_pending_job(preview_key)) return;
+    queue_render_job(preview_key, pz, JOB_PRIO_PREVIEW, 0)->preview = 1;
+}
+
+/* ---------- Fit Zoom ---------- */
+// Fit-width and fit-page follow the scrolled window: the zoom is worked
+// out again from the current page's bounds whenever the view is rendered,
+// and when the window is resized (see on_viewport_changed).
+enum {
+    ZOOM_FREE,
+    ZOOM_FIT_WIDTH,
+    ZOOM_FIT_PAGE,
+};
+
+#define FIT_MARGIN 12   // the scrolled window's border, plus some air
+#define PAGE_GAP   16   // around and between pages in the continuous column
+
+static int zoom_mode = ZOOM_FREE;
+
+static const char *zoom_mode_labels[] = { "FIT: OFF (F)", "FIT: WIDTH (F)", "FIT: PAGE (F)" };
+
+// Moves zoom_factor to what the fit mode asks for at the current window
+// size. Returns whether it changed; sub-pixel differences are ignored so
+// a jittering allocation does not cause renders.
+static int fit_zoom_update(void) {
+    if (zoom_mode == ZOOM_FREE || !doc || !drawing_area || !page_bounds_known[current_page]) return 0;
+    GtkWidget *sc = gtk_widget_get_ancestor(drawing_area, GTK_TYPE_SCROLLED_WINDOW);
+    int aw = sc ? gtk_widget_get_width(sc) - FIT_MARGIN : 0;
+    int ah = sc ? gtk_widget_get_height(sc) - FIT_MARGIN : 0;
+    // The column pads pages by PAGE_GAP on either side and between rows.
+    if (continuous) {
+        aw -= 2 * PAGE_GAP;
+        ah -= PAGE_GAP;
+    }
+    fz_rect b = page_bounds[current_page];
+    if (aw <= 0 || ah <= 0 || b.x1 <= b.x0 || b.y1 <= b.y0) return 0;
+
+    float zoom = aw / (b.x1 - b.x0);
+    if (zoom_mode == ZOOM_FIT_PAGE) zoom = fminf(zoom, ah / (b.y1 - b.y0));
+    zoom = CLAMP(zoom, 0.1f, 5.0f);
+    if (fabsf(zoom - zoom_factor) * (b.x1 - b.x0) < 1.0f) return 0;
+    zoom_factor = zoom;
+    return 1;
+}
+
+/* ---------- Continuous View ---------- */
+// All pages stacked top to bottom in the one drawing area. Nothing is kept
+// per page but a row in the layout table: only pages overlapping the
+// viewport (plus one above and the prefetch window below) are queued, and
+// drawing takes their pictures straight from the page cache, so surfaces
+// that scroll away are left to the cache's LRU. Pages whose bounds are not
+// known yet are laid out at the size of the last known page before them,
+// and the table is redone as real bounds arrive.
+static double *page_top        = NULL;  // y of each page; [page_count] is the end
+static int    *page_px_w       = NULL;
+static int     layout_pages_n  = 0;
+static float   layout_zoom     = 0.0f;
+static int     layout_dirty    = 1;
+static double  scroll_target_y = -1;    // reapplied until the area is tall enough
+
+static GtkAdjustment *view_vadjustment(void) {
+    GtkWidget *sc = drawing_area ? gtk_widget_get_ancestor(drawing_area, GTK_TYPE_SCROLLED_WINDOW) : NULL;
+    return sc ? gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(sc)) : NULL;
+}
+
+static void layout_pages(void) {
+    layout_pages_n = page_count;
+    page_top  = g_renew(double, page_top, page_count + 1);
+    page_px_w = g_renew(int, page_px_w, MAX(page_count, 1));
+
+    fz_rect guess = fz_make_rect(0, 0, 612, 792);   // US Letter until a page says otherwise
+    for (int p = 0; p < page_count; p++) {
+        if (page_bounds_known[p]) { guess = page_bounds[p]; break; }
+    }
+
+    double y = PAGE_GAP;
+    layout_w = 0;
+    for (int p = 0; p < page_count; p++) {
+        if (page_bounds_known[p]) guess = page_bounds[p];
+        fz_irect bbox = page_pixel_bbox(guess, zoom_factor);
+        page_px_w[p] = bbox.x1 - bbox.x0;
+        page_top[p] = y;
+        y += (bbox.y1 - bbox.y0) + PAGE_GAP;
+        layout_w = MAX(layout_w, page_px_w[p]);
+    }
+    page_top[page_count] = y;
+    layout_h = (int)ceil(y);
+    layout_w += 2 * PAGE_GAP;
+    layout_zoom  = zoom_factor;
+    layout_dirty = 0;
+}
+
+static void scroll_to_y(double y) {
+    GtkAdjustment *vadj = view_vadjustment();
+    if (!vadj) return;
+    scroll_target_y = MAX(y, 0.0);
+    set_scroll_value(vadj, scroll_target_y);
+}
+
+// The adjustments clamp to the old height until the area is reallocated,
+// so a scroll made together with a relayout is finished from here.
+static void on_continuous_layout_changed(GtkAdjustment *adj, gpointer data) {
+    if (scroll_target_y < 0) return;
+    set_scroll_value(adj, scroll_target_y);
+    if (gtk_adjustment_get_upper(adj) >= layout_h) scroll_target_y = -1;
+}
+
+// Brings the table up to date with the zoom, page count and known bounds,
+// keeping the same spot of the current page at the top of the viewport.
+static void ensure_layout(void) {
+    if (!layout_dirty && layout_zoom == zoom_factor && layout_pages_n == page_count) return;
+
+    GtkAdjustment *vadj = view_vadjustment();
+    int keep = continuous && vadj && page_top && layout_zoom > 0 && current_page < layout_pages_n;
+    double offset = keep ? (gtk_adjustment_get_value(vadj) - page_top[current_page]) / layout_zoom : 0.0;
+    layout_pages();
+    if (keep) scroll_to_y(page_top[current_page] + offset * zoom_factor);
+}
+
+// The page whose slot, including the gap above it, holds y.
+static int page_at_y(double y) {
+    int lo = 0, hi = page_count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (page_top[mid] - PAGE_GAP <= y) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+// Where the page sits in the drawing area, in pixels. In single-page mode
+// only the current page is placed, centred when smaller than the area.
+static int page_view_rect(int page, double *ox, double *oy, double *pw, double *ph) {
+    if (!drawing_area || !doc || page < 0 || page >= page_count) return 0;
+    double area_w = gtk_widget_get_width(drawing_area);
+    double area_h = gtk_widget_get_height(drawing_area);
+
+    if (!continuous) {
+        *pw = page_w;
+        *ph = page_h;
+        *ox = (area_w > page_w) ? (area_w - page_w) / 2.0 : 0.0;
+        *oy = (area_h > page_h) ? (area_h - page_h) / 2.0 : 0.0;
+        return page == current_page;
+    }
+
+    ensure_layout();
+    *pw = page_px_w[page];
+    *ph = page_top[page + 1] - PAGE_GAP - page_top[page];
+    *ox = floor((MAX(area_w, layout_w) - *pw) / 2.0);
+    *oy = page_top[page];
+    return 1;
+}
+
+static void scroll_to_page(int page) {
+    if (!doc || page < 0 || page >= page_count) return;
+    ensure_layout();
+    scroll_to_y(page_top[page] - PAGE_GAP / 2);
+}
+
+static void visible_page_range(int *p0, int *p1) {
+    GtkAdjustment *vadj = view_vadjustment();
+    double y0 = vadj ? gtk_adjustment_get_value(vadj) : 0.0;
+    double y1 = y0 + (vadj ? gtk_adjustment_get_page_size(vadj) : 0.0);
+    ensure_layout();
+    *p0 = page_at_y(y0);
+    *p1 = page_at_y(y1);
+}
+
+static int page_is_tiled(int page) {
+    return page_bounds_known[page] && page_needs_tiles(page_pixel_bbox(page_bounds[page], render_zoom()));
+}
+
+// Queues what the pages in and around the viewport are missing: whole
+// pages, or for pages too large for one surface a preview plus the tiles
+// in view. Jobs still in flight for them are adopted, so the caller can
+// cancel everything else.
+static void render_visible_pages(void) {
+    int p0, p1;
+    visible_page_range(&p0, &p1);
+    int first = MAX(p0 - 1, 0);
+    int last  = MIN(p1 + prefetch_depth, page_count - 1);
+
+    for (int p = first; p <= last; p++) {
+        int visible = p >= p0 && p <= p1;
+        if (page_is_tiled(p)) {
+            if (!visible) continue;
+            cache_key pk = make_cache_key(p, preview_zoom(p));
+            if (!have_render(pk) && !adopt_pending_job(pk))
+                queue_render_job(pk, preview_zoom(p), JOB_PRIO_PREVIEW, 0)->preview = 1;
+            queue_visible_tiles(p);
+            continue;
+        }
+
+        cache_key key = make_cache_key(p, render_zoom());
+        if (have_render(key)) continue;
+        // A full-density render already cached beats a low-res one.
+        if (fast_scrolling && page_cache_contains(make_cache_key(p, zoom_factor * (float)device_scale))) continue;
+        if (visible)
+            queue_visible_job(key);
+        else if (!adopt_pending_job(key))
+            queue_render_job(key, render_zoom(), JOB_PRIO_PREFETCH + abs(p - p1), 1);
+    }
+}
+
+// While the column scrolls faster than FAST_SCROLL_PX_S on a HiDPI
+// screen, pages are rendered at one pixel per logical pixel, a quarter of
+// the work at 2x; SCROLL_SETTLE_MS after it slows down the pages in view
+// are rendered again at full density. GUF_SCROLL_LOWRES=0 turns this off.
+#define FAST_SCROLL_PX_S 3000.0
+#define SCROLL_SETTLE_MS 120
+
+static guint  scroll_settle_id = 0;
+static double scroll_last_y    = 0;
+static gint64 scroll_last_us   = 0;
+
+static gboolean scroll_settled(gpointer data) {
+    scroll_settle_id = 0;
+    fast_scrolling = 0;
+    if (doc && continuous) {
+        g_atomic_int_inc(&render_generation);
+        render_visible_pages();
+        render_cancel_stale();
+        gtk_widget_queue_draw(drawing_area);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void track_scroll_speed(double y) {
+    gint64 now = g_get_monotonic_time();
+    double dt = (now - scroll_last_us) / 1e6;
+    double speed = dt > 0 ? fabs(y - scroll_last_y) / dt : 0;
+    scroll_last_y  = y;
+    scroll_last_us = now;
+    if (!scroll_lowres || device_scale <= 1.0) return;
+
+    if (dt < 0.1 && speed > FAST_SCROLL_PX_S) fast_scrolling = 1;
+    if (!fast_scrolling) return;
+    if (scroll_settle_id) g_source_remove(scroll_settle_id);
+    scroll_settle_id = g_timeout_add(SCROLL_SETTLE_MS, scroll_settled, NULL);
+}
+
+// The current page is the one at the top of the viewport; page turns,
+// bookmarks, search and selection all work relative to it.
+static void continuous_follow_viewport(void) {
+    GtkAdjustment *vadj = view_vadjustment();
+    if (!vadj) return;
+    ensure_layout();
+    int page = page_at_y(gtk_adjustment_get_value(vadj) + PAGE_GAP);
+    if (page != current_page) {
+        read_direction = (page > current_page) ? 1 : -1;
+        current_page = page;
+        update_ui();
+    }
+}
+
+static void continuous_scrolled(void) {
+    GtkAdjustment *vadj = view_vadjustment();
+    if (!vadj) return;
+    if (!programmatic_scroll) track_scroll_speed(gtk_adjustment_get_value(vadj));
+    continuous_follow_viewport();
+
+    g_atomic_int_inc(&render_generation);
+    render_visible_pages();
+    render_cancel_stale();
+}
+
+// Shows the current page straight from the cache when possible, otherwise
+// shows a scaled preview and queues the sharp render. Pages too large for
+// one surface switch to tiles once their bounds are known.
+static void render_current_page(void) {
+    g_atomic_int_inc(&render_generation);
+    fit_zoom_update();
+
+    if (!doc) {
+        render_cancel_stale();
+        free_page_surface();
+        return;
+    }
+    if (continuous) {
+        update_page_size();
+        render_visible_pages();
+        render_cancel_stale();
+        return;
+    }
+
+    if (show_cached_view()) {
+        schedule_prefetch();
+    } else {
+        request_preview();
+        if (page_tiled) {
+            queue_visible_tiles(current_page);
+        } else {
+            // A prefetch already working on this page is promoted rather
+            // than restarted.
+            queue_visible_job(make_cache_key(current_page, render_zoom()));
+        }
+    }
+
+    if (!page_tiled) adopt_prefetch_window();
+    render_cancel_stale();
+}
+
+static gboolean render_job_done(gpointer data) {
+    render_job *job = data;
+    if (shutting_down) {
+        render_job_free(job);
+        return G_SOURCE_REMOVE;
+    }
+    trace_job(job);
+
+    if (job->kind == JOB_TEXT) {
+        text_job_done(job);
+        render_job_free(job);
+        return G_SOURCE_REMOVE;
+    }
+    if (job->kind == JOB_THUMB) {
+        thumb_job_done(job);
+        render_job_free(job);
+        return G_SOURCE_REMOVE;
+    }
+
+    int was_pending = g_hash_table_lookup(pending_jobs, &job->key) == job;
+    if (was_pending)
+        g_hash_table_remove(pending_jobs, &job->key);
+
+    if (job->doc == doc) {
+        int resized = 0;
+        if (job->have_bounds) {
+            resized = !page_bounds_known[job->page] ||
+                      memcmp(&page_bounds[job->page], &job->bounds, sizeof(fz_rect)) != 0;
+            page_bounds[job->page] = job->bounds;
+            page_bounds_known[job->page] = 1;
+        }
+
+        // Skipped or aborted as stale, then adopted into the current
+        // generation before the worker marked it: it is still wanted.
+        if (was_pending && !job->surface && !job->failed && !job->too_large && !render_job_is_stale(job)) {
+            queue_render_job(job->key, job->zoom, job->priority, job->prefetch)->preview = job->preview;
+            render_job_free(job);
+            return G_SOURCE_REMOVE;
+        }
+
+        // Even a superseded render is still a valid picture of its page.
+        if (job->surface)
+            page_cache_insert(job->key, job->surface);
+
+        // The fit zoom was a guess until the page's size was known.
+        if (resized && job->page == current_page && fit_zoom_update()) {
+            render_current_page();
+            update_page_size();
+            update_ui();
+            render_job_free(job);
+            return G_SOURCE_REMOVE;
+        }
+
+        if (continuous) {
+            if (resized) layout_dirty = 1;
+            if (job->too_large) render_visible_pages();
+            if (job->surface && job->page == current_page && job->key.tx < 0 && !job->preview)
+                queue_text_job(job->page);
+            if (resized) {
+                update_page_size();
+                update_ui();
+            } else if (job->surface) {
+                gtk_widget_queue_draw(drawing_area);
+            }
+        } else if (job->key.tx >= 0) {
+            if (job->surface && page_tiled && is_current_view(job->key))
+                gtk_widget_queue_draw(drawing_area);
+        } else if (job->preview) {
+            if (job->surface && job->page == current_page && better_than_shown(job->zoom)) {
+                set_page_surface(job->surface, job->page, job->zoom);
+                update_page_size();
+                update_ui();
+            }
+        } else if (!render_job_is_stale(job) && !job->prefetch) {
+            if (job->too_large) {
+                render_current_page();
+                update_ui();
+            } else if (job->surface) {
+                set_page_surface(job->surface, job->page, job->zoom);
+                update_page_size();
+                schedule_prefetch();
+                queue_text_job(job->page);
+                update_ui();
+            } else if (job->failed) {
+                free_page_surface();
+                update_ui();
+            }
+        }
+    }
+
+    render_job_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+/* ---------- Request Coalescing ---------- */
+// Held-down keys fire zoom and page turns faster than pages render. The
+// first change of a burst renders at once; later ones only update the view
+// from the cache and push the real render back until input has been quiet
+// for RENDER_SETTLE_MS, so only the settled (page, zoom) is rendered.
+#define RENDER_SETTLE_MS 80
+
+static gboolean settle_timeout(gpointer data) {
+    settle_id = 0;
+    if (settle_dirty) {
+        settle_dirty = 0;
+        if (doc && continuous) continuous_follow_viewport();
+        render_current_page();
+        update_ui();
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void request_render(void) {
+    if (!doc) {
+        render_current_page();
+        return;
+    }
+
+    if (!settle_id) {
+        render_current_page();
+    } else {
+        // Stop spending workers on the views the user has already skipped.
+        g_atomic_int_inc(&render_generation);
+        render_cancel_stale();
+        show_cached_view();
+        settle_dirty = 1;
+        g_source_remove(settle_id);
+    }
+    settle_id = g_timeout_add(RENDER_SETTLE_MS, settle_timeout, NULL);
+}
+
+// Window resizes in a fit mode arrive as a stream of allocations. Each
+// one rescales whatever is on screen at once; the render for the new zoom
+// waits until the size has held for RESIZE_SETTLE_MS.
+#define RESIZE_SETTLE_MS 150
+
+static guint resize_id = 0;
+static int   viewport_w = 0, viewport_h = 0;
+
+static gboolean resize_settled(gpointer data) {
+    resize_id = 0;
+    render_current_page();
+    update_ui();
+    return G_SOURCE_REMOVE;
+}
+
+static void on_viewport_changed(GtkAdjustment *adj, gpointer data) {
+    GtkWidget *sc = gtk_widget_get_ancestor(drawing_area, GTK_TYPE_SCROLLED_WINDOW);
+    int w = gtk_widget_get_width(sc);
+    int h = gtk_widget_get_height(sc);
+    if (w == viewport_w && h == viewport_h) return;
+    viewport_w = w;
+    viewport_h = h;
+    if (!fit_zoom_update()) return;
+
+    g_atomic_int_inc(&render_generation);
+    render_cancel_stale();
+    show_cached_view();
+    update_page_size();
+    update_ui();
+    if (resize_id) g_source_remove(resize_id);
+    resize_id = g_timeout_add(RESIZE_SETTLE_MS, resize_settled, NULL);
+}
+
+/* ---------- Device Scale ---------- */
+// Pages are rendered at the page view's device scale, so a 2x (or, with
+// GTK 4.12, a fractional 1.25x) monitor gets one render pixel per screen
+// pixel. Moving the window to a monitor of another scale re-renders.
+static void update_device_scale(void) {
+    double scale = gtk_widget_get_scale_factor(drawing_area);
+#if GTK_CHECK_VERSION(4, 12, 0)
+    GtkNative *native = gtk_widget_get_native(drawing_area);
+    GdkSurface *surface = native ? gtk_native_get_surface(native) : NULL;
+    if (surface) scale = gdk_surface_get_scale(surface);
+#endif
+    if (scale <= 0 || scale == device_scale) return;
+    device_scale = scale;
+    render_current_page();
+    update_ui();
+}
+
+static void on_scale_changed(GObject *object, GParamSpec *pspec, gpointer data) {
+    update_device_scale();
+}
+
+static void on_view_realize_scale(GtkWidget *widget, gpointer data) {
+#if GTK_CHECK_VERSION(4, 12, 0)
+    GdkSurface *surface = gtk_native_get_surface(gtk_widget_get_native(widget));
+    g_signal_connect(surface, "notify::scale", G_CALLBACK(on_scale_changed), NULL);
+#endif
+    update_device_scale();
+}
+
+/* ---------- UI Refresh ---------- */
+static void update_ui(void) {
+    char buf[128];
+    if (doc && !page_count_known) {
+        snprintf(buf, sizeof(buf),
+                 "PAGE %d/?  [ZOOM: %.0f%%]  COUNTING...",
+                 current_page + 1, zoom_factor * 100.0f);
+    } else if (doc) {
+        snprintf(buf, sizeof(buf),
+                 "PAGE %d/%d  [ZOOM: %.0f%%]  %s",
+                 current_page + 1, page_count,
+                 zoom_factor * 100.0f,
+                 bookmark_page >= 0 ? "*SAVED*" : "");
+    } else if (doc_opening) {
+        snprintf(buf, sizeof(buf), "OPENING...");
+    } else {
+        snprintf(buf, sizeof(buf), "NO DATA LOADED");
+    }
+
+    gtk_label_set_text(GTK_LABEL(page_label), buf);
+
+    gtk_button_set_label(GTK_BUTTON(bookmark_btn),
+        (doc && bookmark_page == current_page) ? "UN-MARK (B)" : "MARK (B)");
+    gtk_button_set_label(GTK_BUTTON(layout_btn), continuous ? "SINGLE (C)" : "SCROLL (C)");
+    gtk_button_set_label(GTK_BUTTON(fit_btn), zoom_mode_labels[zoom_mode]);
+
+    page_view_set_content_size(drawing_area, page_w, page_h);
+    gtk_widget_queue_draw(drawing_area);
+    thumb_strip_follow();
+}
+
+/* ---------- Selection & Clipboard Logic ---------- */
+// A copy made before its page's text was extracted, finished when the
+// text job lands.
+static int    copy_page = -1;
+static fz_rect copy_rect;
+
+static void copy_text_to_clipboard(text_page *text, fz_rect sel) {
+    GArray *hits = g_array_new(FALSE, FALSE, sizeof(int));
+    text_page_query(text, sel, hits);
+
+    GString *text_buffer = g_string_new("");
+    for (guint i = 0; i < hits->len; i++) {
+        fz_stext_line *line = text->lines[g_array_index(hits, int, i)];
+        for (fz_stext_char *ch = line->first_char; ch; ch = ch->next) {
+            g_string_append_unichar(text_buffer, ch->c);
+        }
+        g_string_append_c(text_buffer, '\n');
+    }
+    g_array_free(hits, TRUE);
+
+    if (text_buffer->len > 0) {
+        GdkDisplay *display = gdk_display_get_default();
+        GdkClipboard *clipboard = gdk_display_get_clipboard(display);
+        char *final_text = g_string_free(text_buffer, FALSE);
+        size_t len = strlen(final_text);
+        if (len > 0 && final_text[len - 1] == '\n') final_text[len - 1] = '\0';
+        gdk_clipboard_set_text(clipboard, final_text);
+        g_free(final_text);
+    } else {
+        g_string_free(text_buffer, TRUE);
+    }
+}
+
+static void copy_selection_to_clipboard(void) {
+    if (!doc || selection_rect.x0 >= selection_rect.x1 || selection_rect.y0 >= selection_rect.y1) return;
+
+    fz_rect sel = selection_rect;
+    selection_rect = (fz_rect){0, 0, 0, 0};
+    text_page *text = text_cache_find(current_page);
+    if (text) {
+        copy_page = -1;
+        copy_text_to_clipboard(text, sel);
+        return;
+    }
+    copy_page = current_page;
+    copy_rect = sel;
+    text_page_request(current_page);
+}
+
+// Refreshes selection_lines from the page's text index, if it is ready.
+static void update_selection_lines(void) {
+    g_array_set_size(selection_lines, 0);
+    text_page *text = text_cache_find(current_page);
+    if (!text) return;
+
+    GArray *hits = g_array_new(FALSE, FALSE, sizeof(int));
+    text_page_query(text, selection_rect, hits);
+    for (guint i = 0; i < hits->len; i++)
+        g_array_append_val(selection_lines, text->lines[g_array_index(hits, int, i)]->bbox);
+    g_array_free(hits, TRUE);
+}
+
+// The page's text job has landed (text is NULL if extraction failed).
+static void selection_text_ready(int page, text_page *text) {
+    if (page == copy_page) {
+        copy_page = -1;
+        if (text) copy_text_to_clipboard(text, copy_rect);
+    }
+    if (selecting && page == current_page && text) {
+        update_selection_lines();
+        gtk_widget_queue_draw(drawing_area);
+    }
+}
+
+void on_drag_update(GtkGestureDrag *gesture, double offset_x, double offset_y, gpointer data) {
+    if (!selecting || !doc) return;
+    double current_x = initial_drag_x + offset_x;
+    double current_y = initial_drag_y + offset_y;
+    selection_end_pt = screen_to_pdf(current_x, current_y);
+    selection_rect.x0 = fminf(selection_start_pt.x, selection_end_pt.x);
+    selection_rect.y0 = fminf(selection_start_pt.y, selection_end_pt.y);
+    selection_rect.x1 = fmaxf(selection_start_pt.x, selection_end_pt.x);
+    selection_rect.y1 = fmaxf(selection_start_pt.y, selection_end_pt.y);
+    update_selection_lines();
+    gtk_widget_queue_draw(drawing_area);
+}
+
+void on_drag_begin(GtkGestureDrag *gesture, double x, double y, gpointer data) {
+    if (!doc) return;
+    if (continuous) {
+        ensure_layout();
+        current_page = page_at_y(y);
+        update_ui();
+    }
+    selecting = 1;
+    initial_drag_x = x;
+    initial_drag_y = y;
+    selection_start_pt = screen_to_pdf(x, y);
+    selection_end_pt = selection_start_pt;
+    selection_rect = (fz_rect){0, 0, 0, 0};
+    g_array_set_size(selection_lines, 0);
+    // The live highlight starts once the page's text is in, if the
+    // background pass has not got to it yet.
+    text_page_request(current_page);
+    gtk_widget_queue_draw(drawing_area);
+}
+
+void on_drag_end(GtkGestureDrag *gesture, double velocity_x, double velocity_y, gpointer data) {
+    if (!selecting) return;
+    selecting = 0;
+    g_array_set_size(selection_lines, 0);
+    double offset_x, offset_y;
+    gtk_gesture_drag_get_offset(gesture, &offset_x, &offset_y);
+    double final_x = initial_drag_x + offset_x;
+    double final_y = initial_drag_y + offset_y;
+    selection_end_pt = screen_to_pdf(final_x, final_y);
+
+    selection_rect.x0 = fminf(selection_start_pt.x, selection_end_pt.x);
+    selection_rect.y0 = fminf(selection_start_pt.y, selection_end_pt.y);
+    selection_rect.x1 = fmaxf(selection_start_pt.x, selection_end_pt.x);
+    selection_rect.y1 = fmaxf(selection_start_pt.y, selection_end_pt.y);
+
+    float width = selection_rect.x1 - selection_rect.x0;
+    float height = selection_rect.y1 - selection_rect.y0;
+
+    if (width > 1.0f || height > 1.0f) {
+        copy_selection_to_clipboard();
+    } else {
+        selection_rect = (fz_rect){0, 0, 0, 0};
+    }
+    gtk_widget_queue_draw(drawing_area);
+}
+
+/* ---------- Actions ---------- */
+static void go_to_page(int delta) {
+    if (!doc) return;
+    int np = current_page + delta;
+    if (np < 0) np = 0;
+    if (np >= page_count) np = page_count - 1;
+    if (np == current_page) return;
+
+    read_direction = (np > current_page) ? 1 : -1;
+    current_page = np;
+    selection_rect = (fz_rect){0, 0, 0, 0};
+
+    nav_begin("page");
+    // The column is scrolled first, so it renders the new viewport rather
+    // than queueing the old one and dropping it again; a single page is
+    // rendered first, so the scroll sees whether it is tiled.
+    if (continuous) {
+        reset_scroll_view();
+        request_render();
+    } else {
+        request_render();
+        reset_scroll_view(); // <--- RESET SCROLL ON PAGE CHANGE
+    }
+    update_ui();
+}
+
+static void on_prev(GtkWidget *w, gpointer data) { go_to_page(-1); }
+static void on_next(GtkWidget *w, gpointer data) { go_to_page(1); }
+static void on_zoom_in(GtkWidget *w, gpointer data) {
+    if (!doc) return;
+    zoom_mode = ZOOM_FREE;
+    zoom_factor *= 1.2f;
+    if (zoom_factor > 5.0f) zoom_factor = 5.0f;
+    selection_rect = (fz_rect){0, 0, 0, 0};
+    nav_begin("zoom");
+    request_render();
+    update_ui();
+}
+static void on_zoom_out(GtkWidget *w, gpointer data) {
+    if (!doc) return;
+    zoom_mode = ZOOM_FREE;
+    zoom_factor /= 1.2f;
+    if (zoom_factor < 0.1f) zoom_factor = 0.1f;
+    selection_rect = (fz_rect){0, 0, 0, 0};
+    nav_begin("zoom");
+    request_render();
+    update_ui();
+}
+static void on_toggle_bookmark(GtkWidget *w, gpointer data) {
+    if (!doc) return;
+    bookmark_page = (bookmark_page == current_page) ? -1 : current_page;
+    save_bookmark();
+    update_ui();
+}
+static void on_go_to_bookmark(GtkWidget *w, gpointer data) {
+    if (!doc || bookmark_page < 0) return;
+    current_page = bookmark_page;
+    selection_rect = (fz_rect){0, 0, 0, 0};
+    nav_begin("bookmark");
+    request_render();
+    reset_scroll_view(); // <--- RESET SCROLL ON JUMP TO BOOKMARK
+    update_ui();
+}
+static void on_cycle_fit(GtkWidget *w, gpointer data) {
+    zoom_mode = (zoom_mode + 1) % G_N_ELEMENTS(zoom_mode_labels);
+    if (!doc) { update_ui(); return; }
+    if (fit_zoom_update()) {
+        selection_rect = (fz_rect){0, 0, 0, 0};
+        nav_begin("zoom");
+        request_render();
+    }
+    update_ui();
+}
+static void on_toggle_layout(GtkWidget *w, gpointer data) {
+    continuous = !continuous;
+    layout_dirty = 1;
+    selection_rect = (fz_rect){0, 0, 0, 0};
+    free_page_surface();
+    if (!doc) { update_ui(); return; }
+    nav_begin("layout");
+    update_page_size();
+    update_ui();
+    request_render();
+    reset_scroll_view();
+}
+
+/* ---------- Document Cache ---------- */
+// The open document's cache file (see doccache.h), if it had a valid one.
+// Page sizes are taken from it at open; the search index reads its words
+// instead of extracting text, and the thumbnail strip its thumbnails.
+// Rewritten when the geometry pass or the index has finished something
+// the file lacks, and on close if new thumbnails were rendered.
+static doc_cache *doc_cache_file = NULL;
+static char      *doc_cache_name = NULL;
+static GThread   *doc_cache_save_thread = NULL;
+static int        doc_cache_has_sizes = 0;  // what the file on disk holds
+static int        doc_cache_has_text  = 0;
+
+static void doc_cache_wait_saved(void) {
+    if (doc_cache_save_thread) {
+        g_thread_join(doc_cache_save_thread);
+        doc_cache_save_thread = NULL;
+    }
+}
+
+static void doc_cache_unload(void) {
+    doc_cache_close(doc_cache_file);
+    doc_cache_file = NULL;
+    g_free(doc_cache_name);
+    doc_cache_name = NULL;
+    doc_cache_has_sizes = 0;
+    doc_cache_has_text  = 0;
+}
+
+static void doc_cache_load(void) {
+    doc_cache_unload();
+    if (!doc) return;
+    doc_cache_wait_saved();     // a tab left just now may be writing this file
+    doc_cache_name = doc_cache_path(current_path);
+    doc_cache_file = doc_cache_open(doc_cache_name, page_count);
+    if (!doc_cache_file) return;
+
+    const doc_cache_word *words;
+    const char *pool;
+    doc_cache_has_text  = doc_cache_page_words(doc_cache_file, 0, &words, &pool) >= 0;
+    doc_cache_has_sizes = 1;
+    for (int p = 0; p < page_count; p++) {
+        float box[4];
+        if (!doc_cache_page_size(doc_cache_file, p, box) || box[2] <= box[0] || box[3] <= box[1]) {
+            doc_cache_has_sizes = 0;
+            continue;
+        }
+        page_bounds[p] = fz_make_rect(box[0], box[1], box[2], box[3]);
+        page_bounds_known[p] = 1;
+    }
+    layout_dirty = 1;
+}
+
+// Fills the row from the cache file instead of rendering it.
+static int thumb_load_cached(int page) {
+    const uint16_t *pixels;
+    int w, h;
+    if (!doc_cache_file || !doc_cache_page_thumbnail(doc_cache_file, page, &pixels, &w, &h)) return 0;
+    thumb *t = &thumbs[page];
+    t->pixels = g_memdup2(pixels, (gsize)w * h * sizeof(guint16));
+    t->w = w;
+    t->h = h;
+    thumb_bytes += (size_t)w * h * sizeof(guint16);
+    return 1;
+}
+
+/* ---------- Search ---------- */
+// Whole-word search over an inverted index (word -> every place it occurs)
+// that a background thread fills in page by page. The thread only extracts
+// words; the index, the query and its matches belong to the main thread.
+// A query is a sequence of words that must appear consecutively; the last
+// one may be a prefix, so results show while typing.
+typedef struct search_posting {
+    int     page;
+    int     pos;    // word number within the page
+    fz_rect box;
+} search_posting;
+
+typedef struct search_word {
+    char   *text;   // lower-cased UTF-8
+    fz_rect box;
+} search_word;
+
+typedef struct search_batch {
+    int     generation;
+    int     page;
+    GArray *words;  // search_word, in reading order
+    fz_rect bounds;
+    int     have_bounds;
+} search_batch;
+
+typedef struct search_match {
+    int page;
+    int first;      // into search_rects, one box per word
+    int count;
+} search_match;
+
+static GHashTable *search_index        = NULL; // char* -> GArray of search_posting
+static int         search_pages_done   = 0;
+static GThread    *search_thread       = NULL;
+static fz_document *search_doc         = NULL;
+static gint        search_cancel       = 0;
+static int         search_generation   = 0;
+static int         search_page_total   = 0;    // page_count of search_doc
+static int         search_first_page   = 0;    // where the worker starts; pages before are indexed
+static doc_cache  *search_cache        = NULL; // words to use instead of extracting
+
+static char      **search_terms        = NULL;
+static int         search_nterms       = 0;
+static GArray     *search_matches      = NULL; // search_match, in page order
+static GArray     *search_rects        = NULL; // fz_rect
+static int         search_current      = -1;
+static int         search_reveal       = 0;    // scroll to the current match once laid out
+
+static void search_batch_free(search_batch *b) {
+    for (guint i = 0; i < b->words->len; i++)
+        g_free(g_array_index(b->words, search_word, i).text);
+    g_array_free(b->words, TRUE);
+    g_free(b);
+}
+
+// Splits a page's text into words: runs of letters and digits, never
+// crossing a line.
+static void search_extract_words(fz_stext_page *stext, GArray *words) {
+    GString *word = g_string_new("");
+    fz_rect box = fz_empty_rect;
+
+    for (fz_stext_block *block = stext->first_block; block; block = block->next) {
+        if (block->type != FZ_STEXT_BLOCK_TEXT) continue;
+        for (fz_stext_line *line = block->u.t.first_line; line; line = line->next) {
+            for (fz_stext_char *ch = line->first_char; ; ch = ch->next) {
+                if (ch && g_unichar_isalnum(ch->c)) {
+                    g_string_append_unichar(word, g_unichar_tolower(ch->c));
+                    box = fz_union_rect(box, fz_rect_from_quad(ch->quad));
+                    continue;
+                }
+                if (word->len) {
+                    search_word w = { g_strdup(word->str), box };
+                    g_array_append_val(words, w);
+                    g_string_truncate(word, 0);
+                    box = fz_empty_rect;
+                }
+                if (!ch) break;
+            }
+        }
+    }
+    g_string_free(word, TRUE);
+}
+
+static gboolean search_batch_done(gpointer data);
+
+static gpointer search_index_worker(gpointer data) {
+    fz_context *c = data;
+    int generation = search_generation;
+
+    for (int p = search_first_page; p < search_page_total && !g_atomic_int_get(&search_cancel); p++) {
+        search_batch *b = g_new0(search_batch, 1);
+        b->generation = generation;
+        b->page  = p;
+        b->words = g_array_new(FALSE, FALSE, sizeof(search_word));
+
+        const doc_cache_word *cached;
+        const char *pool;
+        int n = search_cache ? doc_cache_page_words(search_cache, p, &cached, &pool) : -1;
+        if (n >= 0) {
+            for (int i = 0; i < n; i++) {
+                const float *r = cached[i].box;
+                search_word w = { g_strndup(pool + cached[i].text, cached[i].len),
+                                  fz_make_rect(r[0], r[1], r[2], r[3]) };
+                g_array_append_val(b->words, w);
+            }
+            g_idle_add_full(G_PRIORITY_LOW, search_batch_done, b, NULL);
+            continue;
+        }
+
+        fz_display_list *list = NULL;
+        fz_stext_page *stext = NULL;
+        fz_var(list);
+        fz_var(stext);
+
+        // The list is built just for this pass rather than through the
+        // cache, which would push out the lists of the pages on screen.
+        fz_try(c) {
+            list = display_list_build(c, search_doc, p, NULL);
+            b->bounds = fz_bound_display_list(c, list);
+            b->have_bounds = 1;
+            stext = fz_new_stext_page_from_display_list(c, list, NULL);
+            search_extract_words(stext, b->words);
+        } fz_always(c) {
+            fz_drop_stext_page(c, stext);
+            fz_drop_display_list(c, list);
+        } fz_catch(c) {
+            fprintf(stderr, "Error indexing page %d: %s\n", p + 1, fz_caught_message(c));
+        }
+        g_idle_add_full(G_PRIORITY_LOW, search_batch_done, b, NULL);
+    }
+    fz_drop_context(c);
+    return NULL;
+}
+
+static void search_index_stop(void) {
+    if (search_thread) {
+        g_atomic_int_set(&search_cancel, 1);
+        g_thread_join(search_thread);
+        search_thread = NULL;
+    }
+    if (search_doc) {
+        fz_drop_document(ctx, search_doc);
+        search_doc = NULL;
+    }
+    search_cache = NULL;
+    search_generation++;    // batches still queued are dropped on arrival
+    g_hash_table_remove_all(search_index);
+    search_pages_done = 0;
+    g_array_set_size(search_matches, 0);
+    g_array_set_size(search_rects, 0);
+    search_current = -1;
+    search_reveal = 0;
+}
+
+// Hands over the index built so far, which covers the first *pages_done
+// pages (batches are applied in page order), and leaves an empty one.
+static GHashTable *search_index_take(int *pages_done) {
+    GHashTable *index = search_index;
+    *pages_done = search_pages_done;
+    search_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_array_unref);
+    search_index_stop();
+    return index;
+}
+
+// Indexes the pages after the first pages_done, whose postings index
+// already holds (NULL and 0 to start from scratch).
+static void search_index_resume(GHashTable *index, int pages_done) {
+    search_index_stop();
+    if (index) {
+        g_hash_table_destroy(search_index);
+        search_index = index;
+    }
+    if (!doc) return;
+    search_pages_done = pages_done;
+    fz_context *c = fz_clone_context(ctx);
+    if (!c) {
+        fprintf(stderr, "Cannot start the search index: out of memory\n");
+        return;
+    }
+    search_first_page = pages_done;
+    search_doc = fz_keep_document(ctx, doc);
+    search_page_total = page_count;
+    search_cache = doc_cache_file;
+    g_atomic_int_set(&search_cancel, 0);
+    search_thread = g_thread_new("search-index", search_index_worker, c);
+}
+
+static void search_index_start(void) {
+    search_index_resume(NULL, 0);
+}
+
+static int search_term_matches(const char *word, int i) {
+    if (i == search_nterms - 1) return g_str_has_prefix(word, search_terms[i]);
+    return strcmp(word, search_terms[i]) == 0;
+}
+
+static void search_add_match(int page, const fz_rect *boxes, int count) {
+    search_match m = { page, search_rects->len, count };
+    g_array_append_vals(search_rects, boxes, count);
+    g_array_append_val(search_matches, m);
+}
+
+static void search_update_label(void) {
+    char buf[96];
+    int pct = page_count ? search_pages_done * 100 / page_count : 0;
+    if (!search_nterms)
+        buf[0] = '\0';
+    else if (search_current >= 0)
+        snprintf(buf, sizeof(buf), "%d/%u HITS", search_current + 1, search_matches->len);
+    else
+        snprintf(buf, sizeof(buf), "%u HITS", search_matches->len);
+    if (doc && search_pages_done < page_count) {
+        size_t len = strlen(buf);
+        snprintf(buf + len, sizeof(buf) - len, "%sINDEXING %d%%", len ? "  " : "", pct);
+    }
+    gtk_label_set_text(GTK_LABEL(search_label), buf);
+}
+
+typedef struct cache_save {
+    doc_cache_writer *writer;
+    char             *path;
+} cache_save;
+
+static gpointer doc_cache_save_worker(gpointer data) {
+    cache_save *job = data;
+    doc_cache_writer_save(job->writer, job->path);
+    g_free(job->path);
+    g_free(job);
+    return NULL;
+}
+
+static int page_sizes_complete(void) {
+    for (int p = 0; p < page_count; p++)
+        if (!page_bounds_known[p]) return 0;
+    return page_count > 0;
+}
+
+// Writes what is known now to the document's cache file, off the main
+// thread: the page sizes, once the index has seen every page its words
+// turned back into per-page lists, and the thumbnails rendered so far.
+// Nothing is written unless that adds to the file, and never in a way that
+// would drop text or thumbnails the file already has.
+static void doc_cache_save(void) {
+    if (!doc_cache_name || !doc) return;
+    int sizes = page_sizes_complete();
+    int text  = search_page_total == page_count && search_pages_done == search_page_total;
+    if ((!sizes || doc_cache_has_sizes) && (!text || doc_cache_has_text) && !thumbs_unsaved) return;
+
+    int n = page_count;
+    int *count = g_new0(int, n);
+
+    GHashTableIter it;
+    gpointer word, value;
+    g_hash_table_iter_init(&it, search_index);
+    while (text && g_hash_table_iter_next(&it, &word, &value)) {
+        GArray *postings = value;
+        for (guint i = 0; i < postings->len; i++) {
+            search_posting *post = &g_array_index(postings, search_posting, i);
+            count[post->page] = MAX(count[post->page], post->pos + 1);
+        }
+    }
+
+    int *first = g_new0(int, n + 1);
+    for (int p = 0; p < n; p++) first[p + 1] = first[p] + count[p];
+    const char **words = g_new0(const char *, MAX(first[n], 1));
+    fz_rect *boxes = g_new(fz_rect, MAX(first[n], 1));
+
+    g_hash_table_iter_init(&it, search_index);
+    while (text && g_hash_table_iter_next(&it, &word, &value)) {
+        GArray *postings = value;
+        for (guint i = 0; i < postings->len; i++) {
+            search_posting *post = &g_array_index(postings, search_posting, i);
+            words[first[post->page] + post->pos]  = word;
+            boxes[first[post->page] + post->pos] = post->box;
+        }
+    }
+
+    doc_cache_writer *w = doc_cache_writer_new(n);
+    if (text) doc_cache_writer_set_text(w);
+    size_t size;
+    const void *old_text = doc_cache_file && !text ? doc_cache_section(doc_cache_file, DOC_CACHE_TEXT, &size) : NULL;
+    if (old_text) doc_cache_writer_add_section(w, DOC_CACHE_TEXT, old_text, size);
+    for (int p = 0; p < n; p++) {
+        const uint16_t *pixels;
+        int tw, th;
+        if (p < thumbs_n && thumbs[p].pixels)
+            doc_cache_writer_set_thumbnail(w, p, thumbs[p].pixels, thumbs[p].w, thumbs[p].h);
+        else if (doc_cache_file && doc_cache_page_thumbnail(doc_cache_file, p, &pixels, &tw, &th))
+            doc_cache_writer_set_thumbnail(w, p, pixels, tw, th);
+        if (page_bounds_known[p]) {
+            fz_rect r = page_bounds[p];
+            doc_cache_writer_set_page_size(w, p, (float[4]){ r.x0, r.y0, r.x1, r.y1 });
+        }
+        for (int i = first[p]; i < first[p + 1]; i++) {
+            fz_rect r = boxes[i];
+            if (words[i]) doc_cache_writer_add_word(w, p, words[i], (float[4]){ r.x0, r.y0, r.x1, r.y1 });
+        }
+    }
+    g_free(count);
+    g_free(first);
+    g_free(words);
+    g_free(boxes);
+    doc_cache_has_sizes |= sizes;
+    doc_cache_has_text  |= text;
+    thumbs_unsaved = 0;
+
+    cache_save *job = g_new0(cache_save, 1);
+    job->writer = w;
+    job->path   = g_strdup(doc_cache_name);
+    doc_cache_wait_saved();
+    doc_cache_save_thread = g_thread_new("doc-cache-save", doc_cache_save_worker, job);
+}
+
+static gboolean search_batch_done(gpointer data) {
+    search_batch *b = data;
+    if (b->generation != search_generation) {
+        search_batch_free(b);
+        return G_SOURCE_REMOVE;
+    }
+
+    // Match the new page straight from its word list; the index only
+    // serves queries typed later.
+    guint before = search_matches->len;
+    if (search_nterms) {
+        fz_rect boxes[search_nterms];
+        for (int i = 0; i + search_nterms <= (int)b->words->len; i++) {
+            int k = 0;
+            for (; k < search_nterms; k++) {
+                search_word *w = &g_array_index(b->words, search_word, i + k);
+                if (!search_term_matches(w->text, k)) break;
+                boxes[k] = w->box;
+            }
+            if (k == search_nterms) search_add_match(b->page, boxes, k);
+        }
+    }
+
+    for (guint i = 0; i < b->words->len; i++) {
+        search_word *w = &g_array_index(b->words, search_word, i);
+        GArray *postings = g_hash_table_lookup(search_index, w->text);
+        if (!postings) {
+            postings = g_array_new(FALSE, FALSE, sizeof(search_posting));
+            g_hash_table_insert(search_index, w->text, postings);
+        } else {
+            g_free(w->text);
+        }
+        w->text = NULL;
+        search_posting post = { b->page, i, w->box };
+        g_array_append_val(postings, post);
+    }
+
+    if (b->have_bounds && !page_bounds_known[b->page]) {
+        page_bounds[b->page] = b->bounds;
+        page_bounds_known[b->page] = 1;
+        layout_dirty = 1;
+    }
+
+    search_pages_done++;
+    if (search_pages_done == search_page_total) doc_cache_save();
+    if (search_bar && gtk_widget_get_visible(search_bar)) search_update_label();
+    if (search_matches->len != before && b->page == current_page) gtk_widget_queue_draw(drawing_area);
+    search_batch_free(b);
+    return G_SOURCE_REMOVE;
+}
+
+static int compare_posting(gconstpointer a, gconstpointer b) {
+    const search_posting *x = a, *y = b;
+    if (x->page != y->page) return x->page < y->page ? -1 : 1;
+    return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+// Every posting of term i, in (page, pos) order.
+static GArray *search_term_postings(int i) {
+    GArray *out = g_array_new(FALSE, FALSE, sizeof(search_posting));
+    if (i < search_nterms - 1) {
+        GArray *postings = g_hash_table_lookup(search_index, search_terms[i]);
+        if (postings) g_array_append_vals(out, postings->data, postings->len);
+        return out;
+    }
+
+    GHashTableIter it;
+    gpointer word, postings;
+    g_hash_table_iter_init(&it, search_index);
+    while (g_hash_table_iter_next(&it, &word, &postings)) {
+        if (g_str_has_prefix(word, search_terms[i]))
+            g_array_append_vals(out, ((GArray *)postings)->data, ((GArray *)postings)->len);
+    }
+    g_array_sort(out, compare_posting);
+    return out;
+}
+
+static search_posting *search_find_posting(GArray *postings, int page, int pos) {
+    search_posting key = { page, pos, fz_empty_rect };
+    return bsearch(&key, postings->data, postings->len, sizeof(search_posting), compare_posting);
+}
+
+// Splits text into lower-cased words the same way pages are indexed.
+static char **search_split_query(const char *text, int *count) {
+    GPtrArray *terms = g_ptr_array_new();
+    GString *word = g_string_new("");
+    for (const char *p = text; ; p = g_utf8_next_char(p)) {
+        gunichar c = g_utf8_get_char(p);
+        if (c && g_unichar_isalnum(c)) {
+            g_string_append_unichar(word, g_unichar_tolower(c));
+            continue;
+        }
+        if (word->len) {
+            g_ptr_array_add(terms, g_strdup(word->str));
+            g_string_truncate(word, 0);
+        }
+        if (!c) break;
+    }
+    g_string_free(word, TRUE);
+    *count = terms->len;
+    g_ptr_array_add(terms, NULL);
+    return (char **)g_ptr_array_free(terms, FALSE);
+}
+
+// Matches the query terms against the index built so far; pages indexed
+// later are matched as they arrive.
+static void search_match_index(void) {
+    g_array_set_size(search_matches, 0);
+    g_array_set_size(search_rects, 0);
+    search_current = -1;
+
+    if (search_nterms) {
+        GArray *postings[search_nterms];
+        for (int i = 0; i < search_nterms; i++) postings[i] = search_term_postings(i);
+
+        fz_rect boxes[search_nterms];
+        for (guint j = 0; j < postings[0]->len; j++) {
+            search_posting *first = &g_array_index(postings[0], search_posting, j);
+            int k = 1;
+            boxes[0] = first->box;
+            for (; k < search_nterms; k++) {
+                search_posting *next = search_find_posting(postings[k], first->page, first->pos + k);
+                if (!next) break;
+                boxes[k] = next->box;
+            }
+            if (k == search_nterms) search_add_match(first->page, boxes, k);
+        }
+        for (int i = 0; i < search_nterms; i++) g_array_free(postings[i], TRUE);
+    }
+
+    search_update_label();
+    gtk_widget_queue_draw(drawing_area);
+}
+
+static void search_set_query(const char *text) {
+    g_strfreev(search_terms);
+    search_terms = search_split_query(text, &search_nterms);
+    search_match_index();
+}
+
+// The first match on or after page, or search_matches->len.
+static guint search_first_match_from(int page) {
+    guint lo = 0, hi = search_matches->len;
+    while (lo < hi) {
+        guint mid = (lo + hi) / 2;
+        if (g_array_index(search_matches, search_match, mid).page < page) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Scrolls the current match into view. Left pending when the page has not
+// been laid out at its new size yet; the adjustments retry once it has.
+static void search_reveal_current(void) {
+    if (!search_reveal || search_current < 0) return;
+    GtkWidget *sc = gtk_widget_get_ancestor(drawing_area, GTK_TYPE_SCROLLED_WINDOW);
+    if (!sc) return;
+
+    search_match *m = &g_array_index(search_matches, search_match, search_current);
+    fz_rect r = g_array_index(search_rects, fz_rect, m->first);
+    double ox, oy, pw, ph;
+    if (!page_view_rect(m->page, &ox, &oy, &pw, &ph)) return;
+    GtkAdjustment *adjs[2] = {
+        gtk_scrolled_window_get_hadjustment(GTK_SCROLLED_WINDOW(sc)),
+        gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(sc)),
+    };
+    double lo[2] = { ox + r.x0 * zoom_factor, oy + r.y0 * zoom_factor };
+    double hi[2] = { ox + r.x1 * zoom_factor, oy + r.y1 * zoom_factor };
+
+    int done = 1;
+    for (int i = 0; i < 2; i++) {
+        double val  = gtk_adjustment_get_value(adjs[i]);
+        double size = gtk_adjustment_get_page_size(adjs[i]);
+        if (lo[i] >= val && hi[i] <= val + size) continue;
+        if (hi[i] > gtk_adjustment_get_upper(adjs[i])) done = 0;
+        set_scroll_value(adjs[i], lo[i] - size / 3.0);
+    }
+    if (done) search_reveal = 0;
+    if (continuous) scroll_target_y = -1;   // the match's position wins over the page top
+}
+
+static void on_search_layout_changed(GtkAdjustment *adj, gpointer data) {
+    search_reveal_current();
+}
+
+static void search_step(int dir) {
+    if (!doc || !search_matches->len) return;
+    int n = search_matches->len;
+
+    if (search_current >= 0 && g_array_index(search_matches, search_match, search_current).page == current_page) {
+        search_current = (search_current + dir + n) % n;
+    } else if (dir > 0) {
+        search_current = search_first_match_from(current_page) % n;
+    } else {
+        search_current = ((int)search_first_match_from(current_page + 1) - 1 + n) % n;
+    }
+
+    search_match *m = &g_array_index(search_matches, search_match, search_current);
+    if (m->page != current_page) go_to_page(m->page - current_page);
+    search_reveal = 1;
+    search_reveal_current();
+    search_update_label();
+    gtk_widget_queue_draw(drawing_area);
+}
+
+static void on_search_changed(GtkSearchEntry *entry, gpointer data) {
+    search_set_query(gtk_editable_get_text(GTK_EDITABLE(entry)));
+}
+static void on_search_next(GtkWidget *w, gpointer data) { search_step(1); }
+static void on_search_prev(GtkWidget *w, gpointer data) { search_step(-1); }
+
+static void on_search_stop(GtkSearchEntry *entry, gpointer data) {
+    gtk_editable_set_text(GTK_EDITABLE(entry), "");
+    gtk_widget_set_visible(search_bar, FALSE);
+    gtk_widget_grab_focus(drawing_area);
+}
+
+static void on_find(GtkWidget *w, gpointer data) {
+    gtk_widget_set_visible(search_bar, TRUE);
+    gtk_widget_grab_focus(search_entry);
+    search_update_label();
+}
+
+// Matches on the page, highlighted by the page view.
+static void draw_search_hits(GtkSnapshot *snap, int page, double ox, double oy) {
+    static const GdkRGBA hit     = { 1.0f, 0.97f, 0.0f, 0.5f };
+    static const GdkRGBA current = { 1.0f, 0.42f, 0.42f, 0.6f };
+    if (!search_matches || !search_matches->len) return;
+    for (guint i = search_first_match_from(page); i < search_matches->len; i++) {
+        search_match *m = &g_array_index(search_matches, search_match, i);
+        if (m->page != page) break;
+        for (int k = 0; k < m->count; k++) {
+            fz_rect r = g_array_index(search_rects, fz_rect, m->first + k);
+            gtk_snapshot_append_color(snap, (int)i == search_current ? &current : &hit,
+                &GRAPHENE_RECT_INIT(r.x0 * zoom_factor + ox, r.y0 * zoom_factor + oy,
+                                    (r.x1 - r.x0) * zoom_factor, (r.y1 - r.y0) * zoom_factor));
+        }
+    }
+}
+
+/* ---------- Page Geometry ---------- */
+// Bounds for every page without loading any: for PDFs only the page
+// object's MediaBox, CropBox, Rotate and UserUnit are read, which is all
+// fz_bound_page looks at. Other formats still load each page. Runs on its
+// own thread once the pages are counted, taking doc_lock a page at a time
+// so renders are not held up, and posts the results in batches.
+#define GEOMETRY_BATCH 64
+
+typedef struct geometry_batch {
+    int           generation;
+    int           first;
+    int           count;
+    fz_rect       bounds[GEOMETRY_BATCH];
+    unsigned char ok[GEOMETRY_BATCH];
+} geometry_batch;
+
+static GThread     *geometry_thread     = NULL;
+static fz_document *geometry_doc        = NULL;
+static gint         geometry_cancel     = 0;
+static int          geometry_generation = 0;
+static int          geometry_total      = 0;   // page_count of geometry_doc
+
+static fz_rect geometry_bound_page(fz_context *c, fz_document *d, pdf_document *pdf, int p) {
+    if (pdf) {
+        fz_rect mediabox;
+        fz_matrix ctm;
+        pdf_page_obj_transform(c, pdf_lookup_page_obj(c, pdf, p), &mediabox, &ctm);
+        return fz_transform_rect(mediabox, ctm);
+    }
+
+    fz_page *page = fz_load_page(c, d, p);
+    fz_rect bounds = fz_empty_rect;
+    fz_try(c)
+        bounds = fz_bound_page(c, page);
+    fz_always(c)
+        fz_drop_page(c, page);
+    fz_catch(c)
+        fz_rethrow(c);
+    return bounds;
+}
+
+static gboolean geometry_batch_done(gpointer data);
+
+static gpointer geometry_worker(gpointer data) {
+    fz_context *c = data;
+    int generation = geometry_generation;
+    pdf_document *pdf = pdf_specifics(c, geometry_doc);
+    geometry_batch *b = NULL;
+
+    for (int p = 0; p < geometry_total && !g_atomic_int_get(&geometry_cancel); p++) {
+        if (!b) {
+            b = g_new0(geometry_batch, 1);
+            b->generation = generation;
+            b->first = p;
+        }
+        int i = b->count++;
+
+        g_mutex_lock(&doc_lock);
+        fz_try(c) {
+            b->bounds[i] = geometry_bound_page(c, geometry_doc, pdf, p);
+            b->ok[i] = !fz_is_empty_rect(b->bounds[i]);
+        } fz_catch(c) {
+            fprintf(stderr, "Error sizing page %d: %s\n", p + 1, fz_caught_message(c));
+        }
+        g_mutex_unlock(&doc_lock);
+
+        if (b->count == GEOMETRY_BATCH || p == geometry_total - 1) {
+            g_idle_add_full(G_PRIORITY_LOW, geometry_batch_done, b, NULL);
+            b = NULL;
+        }
+    }
+    g_free(b);
+    fz_drop_context(c);
+    return NULL;
+}
+
+static gboolean geometry_batch_done(gpointer data) {
+    geometry_batch *b = data;
+    if (b->generation == geometry_generation) {
+        int changed = 0;
+        for (int i = 0; i < b->count; i++) {
+            int p = b->first + i;
+            if (!b->ok[i] || page_bounds_known[p]) continue;
+            page_bounds[p] = b->bounds[i];
+            page_bounds_known[p] = 1;
+            changed = 1;
+        }
+        if (b->first + b->count == geometry_total) doc_cache_save();
+        if (changed) {
+            layout_dirty = 1;
+            if (continuous) {
+                update_page_size();
+                update_ui();
+            }
+        }
+    }
+    g_free(b);
+    return G_SOURCE_REMOVE;
+}
+
+static void geometry_stop(void) {
+    if (geometry_thread) {
+        g_atomic_int_set(&geometry_cancel, 1);
+        g_thread_join(geometry_thread);
+        geometry_thread = NULL;
+    }
+    if (geometry_doc) {
+        fz_drop_document(ctx, geometry_doc);
+        geometry_doc = NULL;
+    }
+    geometry_generation++;  // batches still queued are dropped on arrival
+}
+
+// Nothing to do when the cache file already had every size.
+static void geometry_start(void) {
+    geometry_stop();
+    if (!doc || page_sizes_complete()) return;
+    // Without the pass, sizes still come from the pages as they render.
+    fz_context *c = fz_clone_context(ctx);
+    if (!c) return;
+    geometry_doc = fz_keep_document(ctx, doc);
+    geometry_total = page_count;
+    g_atomic_int_set(&geometry_cancel, 0);
+    geometry_thread = g_thread_new("page-geometry", geometry_worker, c);
+}
+
+/* ---------- File Handling ---------- */
+// Opening runs on its own thread: fz_open_document can spend seconds
+// repairing a broken xref. The page the view starts on is shown as soon as
+// the document is open, before the pages are counted. Picking another file
+// abandons an open in progress; its result is dropped when it arrives.
+enum {
+    OPEN_FAILED,
+    OPEN_READY,     // document open, pages not counted yet
+    OPEN_COUNTED,
+};
+
+typedef struct open_msg {
+    int          generation;
+    int          stage;
+    fz_document *doc;
+    int          page_count;
+} open_msg;
+
+typedef struct open_job {
+    int          generation;
+    char        *path;
+    fz_context  *ctx;
+} open_job;
+
+static int        open_generation  = 0;
+static int        open_mapped      = 0;     // --mmap / GUF_MMAP: local files via open_mapped_stream
+static int        open_running     = 0;     // under open_lock
+static GMutex     open_lock;
+static GCond      open_cond;
+
+static gboolean open_msg_done(gpointer data);
+
+static void post_open_msg(open_job *job, int stage, fz_document *d, int count) {
+    open_msg *msg = g_new0(open_msg, 1);
+    msg->generation = job->generation;
+    msg->stage      = stage;
+    msg->doc        = d ? fz_keep_document(job->ctx, d) : NULL;
+    msg->page_count = count;
+    g_idle_add(open_msg_done, msg);
+}
+
+static gpointer open_worker(gpointer data) {
+    open_job *job = data;
+    fz_context *c = job->ctx;
+    fz_document *d = NULL;
+    fz_var(d);
+
+    // Remote documents are read through GIO, a range at a time. The name
+    // picks the document handler; URLs like .../download?id=7 get PDF.
+    GFile *file = is_remote(job->path) ? g_file_new_for_uri(job->path) : NULL;
+    char *name = file ? g_file_get_basename(file) : NULL;
+    fz_stream *stm = NULL;
+    fz_var(stm);
+
+    fz_try(c) {
+        if (file) {
+            stm = open_gio_stream(c, file);
+            d = fz_open_document_with_stream(c, name && strchr(name, '.') ? name : "application/pdf", stm);
+        } else if (open_mapped) {
+            stm = open_mapped_stream(c, job->path);
+            d = fz_open_document_with_stream(c, job->path, stm);
+        } else {
+            d = fz_open_document(c, job->path);
+        }
+    } fz_always(c) {
+        fz_drop_stream(c, stm);
+    } fz_catch(c) {
+        fprintf(stderr, "Error opening document: %s\n", fz_caught_message(c));
+    }
+    if (file) g_object_unref(file);
+    g_free(name);
+
+    if (d) {
+        post_open_msg(job, OPEN_READY, d, 0);
+        // Render workers may be on the document already.
+        int count = -1;
+        fz_var(count);
+        g_mutex_lock(&doc_lock);
+        fz_try(c) {
+            count = fz_count_pages(c, d);
+        } fz_always(c) {
+            g_mutex_unlock(&doc_lock);
+        } fz_catch(c) {
+            fprintf(stderr, "Error counting pages: %s\n", fz_caught_message(c));
+        }
+        post_open_msg(job, count >= 0 ? OPEN_COUNTED : OPEN_FAILED, NULL, count);
+        fz_drop_document(c, d);
+    } else {
+        post_open_msg(job, OPEN_FAILED, NULL, 0);
+    }
+
+    fz_drop_context(c);
+    g_free(job->path);
+    g_free(job);
+
+    g_mutex_lock(&open_lock);
+    open_running--;
+    g_cond_broadcast(&open_cond);
+    g_mutex_unlock(&open_lock);
+    return NULL;
+}
+
+static void close_document(void) {
+    doc_cache_save();   // keeps the thumbnails rendered since it was read
+    geometry_stop();
+    search_index_stop();
+    if (doc) { fz_drop_document(ctx, doc); doc = NULL; }
+    page_count = 0;
+    page_count_known = 0;
+    free_page_surface();
+    page_cache_clear();
+    list_cache_clear();
+    text_cache_clear();
+    thumbs_reset(0);
+    g_array_set_size(selection_lines, 0);
+    g_hash_table_remove_all(pending_jobs);
+    page_w = 0; page_h = 0;
+    layout_dirty = 1;
+    scroll_target_y = -1;
+    page_tiled = 0;
+    settle_dirty = 0;
+    selection_rect = (fz_rect){0, 0, 0, 0};
+    copy_page = -1;
+}
+
+// The page to start at once the document being opened is ready, or -1
+// for its bookmark; a tab reopened while it was still opening keeps its
+// place this way.
+static int open_resume_page = -1;
+
+static void open_pdf(const char *path) {
+    close_document();
+    g_free(current_path); current_path = g_strdup(path);
+    zoom_factor = 1.0f;
+
+    fz_context *c = fz_clone_context(ctx);
+    if (!c) {
+        fprintf(stderr, "Error opening document: out of memory\n");
+        open_generation++;      // an open still running is abandoned as well
+        doc_opening = 0;
+        render_current_page();
+        update_ui();
+        return;
+    }
+
+    open_job *job = g_new0(open_job, 1);
+    job->generation = ++open_generation;
+    job->path       = g_strdup(path);
+    job->ctx        = c;
+    doc_opening = 1;
+    g_mutex_lock(&open_lock);
+    open_running++;
+    g_mutex_unlock(&open_lock);
+    g_thread_unref(g_thread_new("open", open_worker, job));
+
+    nav_begin("open");
+    render_current_page();
+    update_ui();
+}
+
+static void on_document_ready(fz_document *d) {
+    doc = d;
+    load_bookmark();
+    // Start where the tab or the bookmark says; the page count checks it later.
+    if (open_resume_page >= 0)
+        current_page = open_resume_page;
+    else
+        current_page = bookmark_page >= 0 ? bookmark_page : 0;
+    open_resume_page = -1;
+    page_count = current_page + 1;
+    reset_page_bounds();
+    render_current_page();
+    reset_scroll_view(); // <--- RESET SCROLL ON OPEN
+    update_ui();
+}
+
+static void on_document_counted(int count) {
+    int shown = page_count;
+    page_count = count;
+    page_count_known = 1;
+    doc_opening = 0;
+
+    page_bounds       = g_renew(fz_rect, page_bounds, MAX(count, 1));
+    page_bounds_known = g_renew(unsigned char, page_bounds_known, MAX(count, 1));
+    if (count > shown) {
+        memset(page_bounds + shown, 0, (count - shown) * sizeof(fz_rect));
+        memset(page_bounds_known + shown, 0, count - shown);
+    }
+
+    if (bookmark_page >= count) bookmark_page = -1;
+    if (current_page >= count) {
+        current_page = 0;
+        render_current_page();
+        reset_scroll_view();
+    }
+    doc_cache_load();
+    thumbs_reset(count);
+    geometry_start();
+    search_index_start();
+    if (search_terms && search_bar) search_update_label();
+    if (continuous) render_current_page();   // the column now has every page
+    schedule_prefetch();
+    update_ui();
+}
+
+static gboolean open_msg_done(gpointer data) {
+    open_msg *msg = data;
+    if (msg->generation == open_generation) {
+        switch (msg->stage) {
+            case OPEN_READY:
+                on_document_ready(msg->doc);
+                msg->doc = NULL;
+                break;
+            case OPEN_COUNTED:
+                on_document_counted(msg->page_count);
+                break;
+            case OPEN_FAILED:
+                close_document();
+                doc_opening = 0;
+                render_current_page();
+                update_ui();
+                break;
+        }
+    }
+    if (msg->doc) fz_drop_document(ctx, msg->doc);
+    g_free(msg);
+    return G_SOURCE_REMOVE;
+}
+
+// Waits out any open still in progress and drops what it posts.
+static void open_threads_join(void) {
+    open_generation++;
+    g_mutex_lock(&open_lock);
+    while (open_running > 0)
+        g_cond_wait(&open_cond, &open_lock);
+    g_mutex_unlock(&open_lock);
+    while (g_main_context_iteration(NULL, FALSE));
+}
+
+static void on_open_response(GtkDialog *dlg, int resp, gpointer data) {
+    if (resp == GTK_RESPONSE_ACCEPT) {
+        GFile *file = gtk_file_chooser_get_file(GTK_FILE_CHOOSER(dlg));
+        char *location = file_location(file);
+        tab_open(location);
+        g_free(location);
+        g_object_unref(file);
+    }
+    gtk_window_destroy(GTK_WINDOW(dlg));
+}
+
+static void on_open(GtkWidget *w, gpointer data) {
+    GtkWindow *win = GTK_WINDOW(gtk_widget_get_ancestor(drawing_area, GTK_TYPE_WINDOW));
+    GtkWidget *dlg = gtk_file_chooser_dialog_new(
+        "OPEN FILE", win, GTK_FILE_CHOOSER_ACTION_OPEN,
+        "_CANCEL", GTK_RESPONSE_CANCEL, "_OPEN", GTK_RESPONSE_ACCEPT, NULL);
+
+    GtkFileFilter *filter = gtk_file_filter_new();
+    gtk_file_filter_set_name(filter, "PDF Documents");
+    gtk_file_filter_add_pattern(filter, "*.pdf");
+    gtk_file_chooser_add_filter(GTK_FILE_CHOOSER(dlg), filter);
+
+    g_signal_connect(dlg, "response", G_CALLBACK(on_open_response), NULL);
+    gtk_widget_show(dlg);
+}
+
+/* ---------- Tabs ---------- */
+// Each tab holds one document, but only the active tab's is live in the
+// globals above. A background tab keeps just its fz_document, its page
+// bounds and where the reader was; the search index, geometry pass, text,
+// thumbnails and rendered pages are dropped when it is left and rebuilt,
+// mostly from the cache file, when it comes back, so it holds no page
+// surfaces. Every tab opens through ctx, so MuPDF's store and font cache,
+// the render workers and the memory budget are shared between them.
+typedef struct doc_tab {
+    char          *path;        // NULL for an empty tab
+    fz_document   *doc;         // NULL while active, or if it must be reopened
+    int            page_count;
+    int            current_page;
+    float          zoom;
+    int            zoom_mode;
+    fz_rect       *page_bounds;
+    unsigned char *page_bounds_known;
+    GHashTable    *search_index;        // the text index so far, kept with doc
+    int            search_pages_done;
+    GtkWidget     *button;
+} doc_tab;
+
+static GPtrArray *tabs       = NULL;
+static doc_tab   *active_tab = NULL;
+static GtkWidget *tab_bar    = NULL;
+
+static void on_tab_clicked(GtkWidget *w, gpointer data);
+
+// Widgets are left alone: at exit they are already gone.
+static void tab_free(doc_tab *t) {
+    if (t->doc) fz_drop_document(ctx, t->doc);
+    g_free(t->page_bounds);
+    g_free(t->page_bounds_known);
+    if (t->search_index) g_hash_table_destroy(t->search_index);
+    g_free(t->path);
+    g_free(t);
+}
 
-    GtkAdjustment *vadj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(sc));
-    GtkAdjustment *hadj = gtk_scrolled_window_get_hadjustment(GTK_SCROLLED_WINDOW(sc));
+static doc_tab *tab_add(void) {
+    doc_tab *t = g_new0(doc_tab, 1);
+    t->zoom   = 1.0f;
+    t->button = gtk_button_new_with_label("");
+    gtk_widget_add_css_class(t->button, "tab");
+    g_signal_connect(t->button, "clicked", G_CALLBACK(on_tab_clicked), t);
+    gtk_box_append(GTK_BOX(tab_bar), t->button);
+    g_ptr_array_add(tabs, t);
+    return t;
+}
 
-    if (vadj) gtk_adjustment_set_value(vadj, 0.0);
-    if (hadj) gtk_adjustment_set_value(hadj, 0.0);
+static void tabs_init(void) {
+    if (!tabs) tabs = g_ptr_array_new();
+    if (!active_tab) active_tab = tab_add();
 }
 
-/* ---------- PDF Rendering ---------- */
-static void free_page_surface(void) {
-    if (page_surface) cairo_surface_destroy(page_surface);
-    g_free(page_pixels);
-    page_surface = NULL;
-    page_pixels  = NULL;
+static void tabs_refresh(void) {
+    for (guint i = 0; i < tabs->len; i++) {
+        doc_tab *t = g_ptr_array_index(tabs, i);
+        const char *path = t == active_tab ? current_path : t->path;
+        char *name = path ? g_path_get_basename(path) : g_strdup("EMPTY");
+        gtk_button_set_label(GTK_BUTTON(t->button), name);
+        g_free(name);
+        if (t == active_tab) gtk_widget_add_css_class(t->button, "active");
+        else gtk_widget_remove_css_class(t->button, "active");
+    }
+    gtk_widget_set_visible(tab_bar, tabs->len > 1);
 }
 
-static void render_current_page(void) {
-    free_page_surface();
-    if (!doc) return;
+// Moves the live document into the active tab and releases everything
+// derived from it. A document still being opened or counted is dropped
+// and opened again when the tab comes back.
+static void tab_suspend(void) {
+    doc_tab *t = active_tab;
+    doc_cache_save();   // before the document is handed to the tab
+    g_free(t->path);
+    t->path         = current_path;
+    // Still opening: the page it was asked to start at stands (-1 for
+    // its bookmark).
+    t->current_page = doc ? current_page : open_resume_page;
+    open_resume_page = -1;
+    t->zoom         = zoom_factor;
+    t->zoom_mode    = zoom_mode;
+    current_path    = NULL;
+    if (doc && page_count_known) {
+        t->doc               = doc;
+        t->page_count        = page_count;
+        t->page_bounds       = page_bounds;
+        t->page_bounds_known = page_bounds_known;
+        t->search_index      = search_index_take(&t->search_pages_done);
+        doc               = NULL;
+        page_bounds       = NULL;
+        page_bounds_known = NULL;
+    }
+    open_generation++;
+    doc_opening = 0;
+    close_document();
+    doc_cache_unload();
+}
 
-    fz_page *page = NULL;
-    fz_pixmap *pix = NULL;
+static void tab_resume(doc_tab *t) {
+    active_tab   = t;
+    current_path = t->path;
+    zoom_mode    = t->zoom_mode;
+    t->path      = NULL;
+    if (!t->doc) {
+        if (current_path) {
+            char *path = current_path;
+            current_path = NULL;
+            open_pdf(path);
+            g_free(path);
+            // Dropped while opening (or never opened): return to its place.
+            open_resume_page = t->current_page;
+            zoom_factor      = t->zoom;
+        } else {
+            render_current_page();
+            update_ui();
+        }
+        tabs_refresh();
+        return;
+    }
 
-    fz_try(ctx) {
-        page = fz_load_page(ctx, doc, current_page);
-        if (!page) fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to load page %d", current_page);
+    doc               = t->doc;
+    page_bounds       = t->page_bounds;
+    page_bounds_known = t->page_bounds_known;
+    page_count        = t->page_count;
+    page_count_known  = 1;
+    current_page      = t->current_page;
+    zoom_factor       = t->zoom;
+    GHashTable *index    = t->search_index;
+    t->doc               = NULL;
+    t->page_bounds       = NULL;
+    t->page_bounds_known = NULL;
+    t->search_index      = NULL;
+
+    load_bookmark();
+    doc_cache_load();
+    thumbs_reset(page_count);
+    geometry_start();
+    // The pages indexed before the tab was left are not extracted again.
+    search_index_resume(index, t->search_pages_done);
+    if (search_terms && search_bar) search_match_index();
+    update_page_size();
+    nav_begin("tab");
+    render_current_page();
+    reset_scroll_view();
+    update_ui();
+    tabs_refresh();
+}
 
-        fz_matrix ctm = fz_scale(zoom_factor, zoom_factor);
-        pix = fz_new_pixmap_from_page(ctx, page, ctm, fz_device_rgb(ctx), 0);
+static void tab_switch(doc_tab *t) {
+    if (t == active_tab) return;
+    tab_suspend();
+    tab_resume(t);
+}
 
-        page_w = fz_pixmap_width(ctx, pix);
-        page_h = fz_pixmap_height(ctx, pix);
-        int in_stride = fz_pixmap_stride(ctx, pix);
-        unsigned char *in = fz_pixmap_samples(ctx, pix);
+static void on_tab_clicked(GtkWidget *w, gpointer data) {
+    tab_switch(data);
+}
 
-        int out_stride = page_w * 4;
-        page_pixels = g_malloc(out_stride * page_h);
+static void tab_step(int dir) {
+    if (tabs->len < 2) return;
+    guint i;
+    g_ptr_array_find(tabs, active_tab, &i);
+    tab_switch(g_ptr_array_index(tabs, (i + tabs->len + dir) % tabs->len));
+}
 
-        for (int y = 0; y < page_h; y++) {
-            unsigned char *src = in + y * in_stride;
-            unsigned char *dst = page_pixels + y * out_stride;
-            for (int x = 0; x < page_w; x++) {
-                dst[4*x + 0] = src[3*x + 2]; // B
-                dst[4*x + 1] = src[3*x + 1]; // G
-                dst[4*x + 2] = src[3*x + 0]; // R
-                dst[4*x + 3] = 255;          // A
-            }
-        }
+// Opens path in a new tab, or in the active one while that is empty.
+static void tab_open(const char *path) {
+    if (current_path) {
+        tab_suspend();
+        active_tab = tab_add();
+    }
+    open_pdf(path);
+    tabs_refresh();
+}
 
-        page_surface = cairo_image_surface_create_for_data(
-            page_pixels, CAIRO_FORMAT_ARGB32, page_w, page_h, out_stride);
+static void tab_close_active(void);
 
-    } fz_always(ctx) {
-        fz_drop_pixmap(ctx, pix);
-        fz_drop_page(ctx, page);
-    } fz_catch(ctx) {
-        fprintf(stderr, "Error rendering page: %s\n", fz_caught_message(ctx));
-        free_page_surface();
+// Leaves one empty tab.
+static void tabs_close_all(void) {
+    for (guint i = tabs->len; i-- > 0;) {
+        doc_tab *t = g_ptr_array_index(tabs, i);
+        if (t == active_tab) continue;
+        g_ptr_array_remove_index(tabs, i);
+        gtk_box_remove(GTK_BOX(tab_bar), t->button);
+        tab_free(t);
     }
+    tab_close_active();
 }
 
-/* ---------- UI Refresh ---------- */
-static void update_ui(void) {
-    char buf[128];
-    if (doc) {
-        snprintf(buf, sizeof(buf),
-                 "PAGE %d/%d  [ZOOM: %.0f%%]  %s",
-                 current_page + 1, page_count,
-                 zoom_factor * 100.0f,
-                 bookmark_page >= 0 ? "*SAVED*" : "");
-    } else {
-        snprintf(buf, sizeof(buf), "NO DATA LOADED");
+// Closing the last tab leaves it empty rather than removing it.
+static void tab_close_active(void) {
+    if (tabs->len < 2) {
+        open_generation++;
+        doc_opening = 0;
+        close_document();
+        doc_cache_unload();
+        g_free(current_path);
+        current_path = NULL;
+        render_current_page();
+        update_ui();
+        tabs_refresh();
+        return;
     }
 
-    gtk_label_set_text(GTK_LABEL(page_label), buf);
+    guint i;
+    g_ptr_array_find(tabs, active_tab, &i);
+    doc_tab *closing = active_tab;
+    tab_suspend();
+    g_ptr_array_remove_index(tabs, i);
+    gtk_box_remove(GTK_BOX(tab_bar), closing->button);
+    tab_free(closing);
+    tab_resume(g_ptr_array_index(tabs, MIN(i, tabs->len - 1)));
+}
 
-    gtk_button_set_label(GTK_BUTTON(bookmark_btn),
-        (doc && bookmark_page == current_page) ? "UN-MARK (B)" : "MARK (B)");
+/* ---------- Drawing ---------- */
+// The page view is a plain widget whose snapshot() hands GTK textures
+// rather than painting pixels: the cached renders are uploaded once and
+// GSK composites, scales and scrolls them on the GPU. Overlays are colour
+// nodes. Since a scrolled snapshot is reused as is, only what is near the
+// viewport goes in, and scrolling queues a new snapshot when pages or
+// tiles come into view.
+#define GUF_TYPE_PAGE_VIEW (guf_page_view_get_type())
+G_DECLARE_FINAL_TYPE(GufPageView, guf_page_view, GUF, PAGE_VIEW, GtkWidget)
+
+struct _GufPageView {
+    GtkWidget parent_instance;
+    int       content_w, content_h;
+};
+
+G_DEFINE_TYPE(GufPageView, guf_page_view, GTK_TYPE_WIDGET)
+
+static const GdkRGBA color_black  = { 0.0f, 0.0f, 0.0f, 1.0f };
+static const GdkRGBA color_white  = { 1.0f, 1.0f, 1.0f, 1.0f };
+static const GdkRGBA color_lines  = { 1.0f, 0.9f, 0.0f, 0.5f };
+static const GdkRGBA color_select = { 1.0f, 0.0f, 0.8f, 0.4f };
+
+static void page_view_set_content_size(GtkWidget *widget, int w, int h) {
+    GufPageView *view = GUF_PAGE_VIEW(widget);
+    if (view->content_w == w && view->content_h == h) return;
+    view->content_w = w;
+    view->content_h = h;
+    gtk_widget_queue_resize(widget);
+}
 
-    gtk_drawing_area_set_content_width(GTK_DRAWING_AREA(drawing_area), page_w);
-    gtk_drawing_area_set_content_height(GTK_DRAWING_AREA(drawing_area), page_h);
-    gtk_widget_queue_draw(drawing_area);
+static void snapshot_rect(GtkSnapshot *snap, const GdkRGBA *color, double x, double y, double w, double h) {
+    gtk_snapshot_append_color(snap, color, &GRAPHENE_RECT_INIT(x, y, w, h));
 }
 
-/* ---------- Selection & Clipboard Logic ---------- */
-static int rect_intersects_selection(fz_rect r1, fz_rect r2) {
-    if (r1.x1 <= r2.x0 || r1.x0 >= r2.x1) return 0;
-    if (r1.y1 <= r2.y0 || r1.y0 >= r2.y1) return 0;
-    return 1;
+// A border of width px centred on the rectangle's edge, like a Cairo stroke.
+static void snapshot_frame(GtkSnapshot *snap, const GdkRGBA *color, double x, double y, double w, double h, double px) {
+    x -= px / 2; y -= px / 2; w += px; h += px;
+    snapshot_rect(snap, color, x, y, w, px);
+    snapshot_rect(snap, color, x, y + h - px, w, px);
+    snapshot_rect(snap, color, x, y + px, px, h - 2 * px);
+    snapshot_rect(snap, color, x + w - px, y + px, px, h - 2 * px);
 }
 
-static void copy_selection_to_clipboard(void) {
-    if (!doc || selection_rect.x0 >= selection_rect.x1 || selection_rect.y0 >= selection_rect.y1) return;
+// Whichever of the page's tiles near the viewport are ready; the rest show
+// the preview until their job lands.
+static void snapshot_page_tiles(GtkSnapshot *snap, int page, double ox, double oy) {
+    int tx0, ty0, tx1, ty1;
+    if (!visible_tiles(page, &tx0, &ty0, &tx1, &ty1)) return;
+
+    // Tiles are cut in render pixels; the view is laid out in logical ones.
+    float zoom = render_zoom();
+    double s = zoom / zoom_factor;
+    for (int ty = MAX(ty0 - 1, 0); ty <= ty1 + 1; ty++) {
+        for (int tx = MAX(tx0 - 1, 0); tx <= tx1 + 1; tx++) {
+            GdkTexture *tile = page_cache_peek_texture(make_tile_key(page, zoom, tx, ty));
+            if (!tile) continue;
+            gtk_snapshot_append_texture(snap, tile,
+                &GRAPHENE_RECT_INIT(ox + tx * TILE_SIZE / s, oy + ty * TILE_SIZE / s,
+                                    gdk_texture_get_width(tile) / s, gdk_texture_get_height(tile) / s));
+        }
+    }
+}
 
-    fz_page *page = NULL;
-    fz_stext_page *stext_page = NULL;
-    GString *text_buffer = g_string_new("");
+static void snapshot_selection(GtkSnapshot *snap, double ox, double oy) {
+    // --- NEO-BRUTALIST SELECTION DRAWING ---
+    if (!doc || !(selection_rect.x1 > selection_rect.x0 || selection_rect.y1 > selection_rect.y0)) return;
+
+    // The lines that will be copied, highlighted while dragging.
+    for (guint i = 0; i < selection_lines->len; i++) {
+        fz_rect r = g_array_index(selection_lines, fz_rect, i);
+        snapshot_rect(snap, &color_lines, r.x0 * zoom_factor + ox, r.y0 * zoom_factor + oy,
+                      (r.x1 - r.x0) * zoom_factor, (r.y1 - r.y0) * zoom_factor);
+    }
 
-    fz_try(ctx) {
-        page = fz_load_page(ctx, doc, current_page);
-        stext_page = fz_new_stext_page_from_page(ctx, page, NULL);
+    double sx0 = selection_rect.x0 * zoom_factor + ox;
+    double sy0 = selection_rect.y0 * zoom_factor + oy;
+    double sel_w = (selection_rect.x1 - selection_rect.x0) * zoom_factor;
+    double sel_h = (selection_rect.y1 - selection_rect.y0) * zoom_factor;
 
-        for (fz_stext_block *block = stext_page->first_block; block; block = block->next) {
-            if (block->type != FZ_STEXT_BLOCK_TEXT) continue;
-            for (fz_stext_line *line = block->u.t.first_line; line; line = line->next) {
-                if (!rect_intersects_selection(line->bbox, selection_rect)) continue;
-                for (fz_stext_char *ch = line->first_char; ch; ch = ch->next) {
-                    g_string_append_unichar(text_buffer, ch->c);
-                }
-                g_string_append_c(text_buffer, '\n');
-            }
-        }
+    // High Contrast Neon Pink Fill, Thick Black Border
+    snapshot_rect(snap, &color_select, sx0, sy0, sel_w, sel_h);
+    snapshot_frame(snap, &color_black, sx0, sy0, sel_w, sel_h, 3.0);
+}
 
-        if (text_buffer->len > 0) {
-            GdkDisplay *display = gdk_display_get_default();
-            GdkClipboard *clipboard = gdk_display_get_clipboard(display);
-            char *final_text = g_string_free(text_buffer, FALSE);
-            size_t len = strlen(final_text);
-            if (len > 0 && final_text[len - 1] == '\n') final_text[len - 1] = '\0';
-            gdk_clipboard_set_text(clipboard, final_text);
-            g_free(final_text);
-        } else {
-            g_string_free(text_buffer, TRUE);
+// Pages in and just around the viewport, each from the cache: the exact
+// render, else the closest one scaled, else a blank sheet.
+static void snapshot_continuous(GtkSnapshot *snap) {
+    int p0, p1;
+    visible_page_range(&p0, &p1);
+
+    for (int p = MAX(p0 - 1, 0); p <= MIN(p1 + 1, page_count - 1); p++) {
+        double ox, oy, pw, ph;
+        if (!page_view_rect(p, &ox, &oy, &pw, &ph)) continue;
+        snapshot_frame(snap, &color_black, ox, oy, pw, ph, 3.0);
+
+        int tiled = page_is_tiled(p);
+        GdkTexture *t = tiled ? NULL : page_cache_peek_texture(make_cache_key(p, render_zoom()));
+        if (!t) {
+            float found_zoom;
+            if (page_cache_closest(p, render_zoom(), &found_zoom))
+                t = page_cache_peek_texture(make_cache_key(p, found_zoom));
         }
-    } fz_always(ctx) {
-        fz_drop_stext_page(ctx, stext_page);
-        fz_drop_page(ctx, page);
-        selection_rect = (fz_rect){0, 0, 0, 0};
-    } fz_catch(ctx) {
-        g_string_free(text_buffer, TRUE);
-    }
-}
+        if (t) gtk_snapshot_append_texture(snap, t, &GRAPHENE_RECT_INIT(ox, oy, pw, ph));
+        if (tiled) snapshot_page_tiles(snap, p, ox, oy);
 
-void on_drag_update(GtkGestureDrag *gesture, double offset_x, double offset_y, gpointer data) {
-    if (!selecting || !doc) return;
-    double current_x = initial_drag_x + offset_x;
-    double current_y = initial_drag_y + offset_y;
-    selection_end_pt = screen_to_pdf(current_x, current_y);
-    selection_rect.x0 = fminf(selection_start_pt.x, selection_end_pt.x);
-    selection_rect.y0 = fminf(selection_start_pt.y, selection_end_pt.y);
-    selection_rect.x1 = fmaxf(selection_start_pt.x, selection_end_pt.x);
-    selection_rect.y1 = fmaxf(selection_start_pt.y, selection_end_pt.y);
-    gtk_widget_queue_draw(drawing_area);
+        draw_search_hits(snap, p, ox, oy);
+        if (p == current_page) snapshot_selection(snap, ox, oy);
+    }
 }
 
-void on_drag_begin(GtkGestureDrag *gesture, double x, double y, gpointer data) {
-    if (!doc) return;
-    selecting = 1;
-    initial_drag_x = x;
-    initial_drag_y = y;
-    selection_start_pt = screen_to_pdf(x, y);
-    selection_end_pt = selection_start_pt;
-    selection_rect = (fz_rect){0, 0, 0, 0};
-    gtk_widget_queue_draw(drawing_area);
-}
+static void page_view_snapshot(GtkWidget *widget, GtkSnapshot *snap) {
+    int w = gtk_widget_get_width(widget);
+    int h = gtk_widget_get_height(widget);
+    snapshot_rect(snap, &color_white, 0, 0, w, h);
 
-void on_drag_end(GtkGestureDrag *gesture, double velocity_x, double velocity_y, gpointer data) {
-    if (!selecting) return;
-    selecting = 0;
-    double offset_x, offset_y;
-    gtk_gesture_drag_get_offset(gesture, &offset_x, &offset_y);
-    double final_x = initial_drag_x + offset_x;
-    double final_y = initial_drag_y + offset_y;
-    selection_end_pt = screen_to_pdf(final_x, final_y);
+    if (continuous) {
+        if (doc && page_count > 0) snapshot_continuous(snap);
+        return;
+    }
 
-    selection_rect.x0 = fminf(selection_start_pt.x, selection_end_pt.x);
-    selection_rect.y0 = fminf(selection_start_pt.y, selection_end_pt.y);
-    selection_rect.x1 = fmaxf(selection_start_pt.x, selection_end_pt.x);
-    selection_rect.y1 = fmaxf(selection_start_pt.y, selection_end_pt.y);
+    if (!page_texture && !page_tiled) return;
 
-    float width = selection_rect.x1 - selection_rect.x0;
-    float height = selection_rect.y1 - selection_rect.y0;
+    double ox = (w > page_w) ? (w - page_w) / 2.0 : 0;
+    double oy = (h > page_h) ? (h - page_h) / 2.0 : 0;
 
-    if (width > 1.0f || height > 1.0f) {
-        copy_selection_to_clipboard();
-    } else {
-        selection_rect = (fz_rect){0, 0, 0, 0};
+    if (page_texture) {
+        // A render at another zoom stands in, scaled, until the sharp one
+        // (or its tiles, drawn on top) arrives. Another page's render keeps
+        // its own size until the new page lands.
+        int same = page_surface_page == current_page;
+        gtk_snapshot_append_texture(snap, page_texture,
+            &GRAPHENE_RECT_INIT(ox, oy, same ? page_w : surface_logical_width(page_surface),
+                                        same ? page_h : surface_logical_height(page_surface)));
     }
-    gtk_widget_queue_draw(drawing_area);
-}
 
-/* ---------- Actions ---------- */
-static void go_to_page(int delta) {
-    if (!doc) return;
-    int np = current_page + delta;
-    if (np < 0) np = 0;
-    if (np >= page_count) np = page_count - 1;
-    if (np == current_page) return;
+    if (page_tiled) snapshot_page_tiles(snap, current_page, ox, oy);
 
-    current_page = np;
-    selection_rect = (fz_rect){0, 0, 0, 0};
+    draw_search_hits(snap, current_page, ox, oy);
+    snapshot_selection(snap, ox, oy);
+}
 
-    render_current_page();
-    reset_scroll_view(); // <--- RESET SCROLL ON PAGE CHANGE
-    update_ui();
+// Whether the view shows the current page at the current zoom, rather
+// than a scaled stand-in or blank tiles.
+static int view_is_sharp(void) {
+    if (!doc) return !doc_opening;
+    if (page_is_tiled(current_page)) {
+        int tx0, ty0, tx1, ty1;
+        if (!visible_tiles(current_page, &tx0, &ty0, &tx1, &ty1)) return 1;
+        for (int ty = ty0; ty <= ty1; ty++)
+            for (int tx = tx0; tx <= tx1; tx++)
+                if (!have_render(make_tile_key(current_page, render_zoom(), tx, ty))) return 0;
+        return 1;
+    }
+    if (continuous) return have_render(make_cache_key(current_page, render_zoom()));
+    return page_texture && page_surface_page == current_page && !render_surface_is_draft(page_surface) &&
+           make_cache_key(0, page_surface_zoom).zoom == make_cache_key(0, render_zoom()).zoom;
 }
 
-static void on_prev(GtkWidget *w, gpointer data) { go_to_page(-1); }
-static void on_next(GtkWidget *w, gpointer data) { go_to_page(1); }
-static void on_zoom_in(GtkWidget *w, gpointer data) {
-    if (!doc) return;
-    zoom_factor *= 1.2f;
-    if (zoom_factor > 5.0f) zoom_factor = 5.0f;
-    selection_rect = (fz_rect){0, 0, 0, 0};
-    render_current_page();
-    update_ui();
+static void guf_page_view_snapshot(GtkWidget *widget, GtkSnapshot *snap) {
+    gint64 start = g_get_monotonic_time();
+    page_view_snapshot(widget, snap);
+    hud_snapshot_us = g_get_monotonic_time() - start;
+    if (nav_start && view_is_sharp()) nav_drawn = 1;
 }
-static void on_zoom_out(GtkWidget *w, gpointer data) {
-    if (!doc) return;
-    zoom_factor /= 1.2f;
-    if (zoom_factor < 0.1f) zoom_factor = 0.1f;
-    selection_rect = (fz_rect){0, 0, 0, 0};
-    render_current_page();
-    update_ui();
+
+static void guf_page_view_measure(GtkWidget *widget, GtkOrientation orientation, int for_size,
+                                  int *minimum, int *natural, int *minimum_baseline, int *natural_baseline) {
+    GufPageView *view = GUF_PAGE_VIEW(widget);
+    *minimum = *natural = (orientation == GTK_ORIENTATION_HORIZONTAL) ? view->content_w : view->content_h;
 }
-static void on_toggle_bookmark(GtkWidget *w, gpointer data) {
-    if (!doc) return;
-    bookmark_page = (bookmark_page == current_page) ? -1 : current_page;
-    save_bookmark();
-    update_ui();
+
+static void guf_page_view_class_init(GufPageViewClass *klass) {
+    GtkWidgetClass *widget_class = GTK_WIDGET_CLASS(klass);
+    widget_class->snapshot = guf_page_view_snapshot;
+    widget_class->measure  = guf_page_view_measure;
+    gtk_widget_class_set_css_name(widget_class, "pageview");
 }
-static void on_go_to_bookmark(GtkWidget *w, gpointer data) {
-    if (!doc || bookmark_page < 0) return;
-    current_page = bookmark_page;
-    selection_rect = (fz_rect){0, 0, 0, 0};
-    render_current_page();
-    reset_scroll_view(); // <--- RESET SCROLL ON JUMP TO BOOKMARK
-    update_ui();
+
+static void guf_page_view_init(GufPageView *view) {
 }
 
-/* ---------- File Handling ---------- */
-static void open_pdf(const char *path) {
-    if (doc) { fz_drop_document(ctx, doc); doc = NULL; }
-    free_page_surface();
-    g_free(current_path); current_path = g_strdup(path);
-    zoom_factor = 1.0f;
-    page_w = 0; page_h = 0;
-    selection_rect = (fz_rect){0, 0, 0, 0};
+// The thumbnail strip: fixed-height rows, so the visible ones follow from
+// the scroll position alone and only those are requested and drawn.
+#define THUMB_PAD   8
+#define THUMB_ROW   (THUMB_H + 2 * THUMB_PAD)
+#define THUMB_STRIP (THUMB_W + 2 * THUMB_PAD)
 
-    fz_try(ctx) {
-        doc = fz_open_document(ctx, current_path);
-        page_count = fz_count_pages(ctx, doc);
-        current_page = 0;
-        load_bookmark();
-        if (bookmark_page >= 0 && bookmark_page < page_count) {
-            current_page = bookmark_page;
-        } else {
-            bookmark_page = -1;
-        }
-    } fz_catch(ctx) {
-        fprintf(stderr, "Error opening document: %s\n", fz_caught_message(ctx));
-        doc = NULL;
-        page_count = 0;
-    }
-    render_current_page();
-    reset_scroll_view(); // <--- RESET SCROLL ON OPEN
-    update_ui();
-}
+#define GUF_TYPE_THUMB_STRIP (guf_thumb_strip_get_type())
+G_DECLARE_FINAL_TYPE(GufThumbStrip, guf_thumb_strip, GUF, THUMB_STRIP, GtkWidget)
 
-static void on_open_response(GtkDialog *dlg, int resp, gpointer data) {
-    if (resp == GTK_RESPONSE_ACCEPT) {
-        GFile *file = gtk_file_chooser_get_file(GTK_FILE_CHOOSER(dlg));
-        char *path = g_file_get_path(file);
-        open_pdf(path);
-        g_free(path);
-        g_object_unref(file);
-    }
-    gtk_window_destroy(GTK_WINDOW(dlg));
-}
+struct _GufThumbStrip {
+    GtkWidget parent_instance;
+};
 
-static void on_open(GtkWidget *w, gpointer data) {
-    GtkWindow *win = GTK_WINDOW(gtk_widget_get_ancestor(drawing_area, GTK_TYPE_WINDOW));
-    GtkWidget *dlg = gtk_file_chooser_dialog_new(
-        "OPEN FILE", win, GTK_FILE_CHOOSER_ACTION_OPEN,
-        "_CANCEL", GTK_RESPONSE_CANCEL, "_OPEN", GTK_RESPONSE_ACCEPT, NULL);
+G_DEFINE_TYPE(GufThumbStrip, guf_thumb_strip, GTK_TYPE_WIDGET)
 
-    GtkFileFilter *filter = gtk_file_filter_new();
-    gtk_file_filter_set_name(filter, "PDF Documents");
-    gtk_file_filter_add_pattern(filter, "*.pdf");
-    gtk_file_chooser_add_filter(GTK_FILE_CHOOSER(dlg), filter);
+static GtkWidget *thumb_strip    = NULL;
+static GtkWidget *thumb_scroller = NULL;
 
-    g_signal_connect(dlg, "response", G_CALLBACK(on_open_response), NULL);
-    gtk_widget_show(dlg);
+static const GdkRGBA color_current = { 1.0f, 0.0f, 0.8f, 1.0f };
+
+static void thumb_visible_rows(int *first, int *last) {
+    GtkAdjustment *vadj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(thumb_scroller));
+    double y = gtk_adjustment_get_value(vadj);
+    *first = (int)(y / THUMB_ROW);
+    *last  = MIN((int)((y + gtk_adjustment_get_page_size(vadj)) / THUMB_ROW), thumbs_n - 1);
 }
 
-/* ---------- Drawing ---------- */
-static void draw_cb(GtkDrawingArea *area, cairo_t *cr, int w, int h, gpointer data) {
-    cairo_set_source_rgb(cr, 1, 1, 1);
-    cairo_paint(cr);
+static int thumb_strip_shown(void) {
+    return thumb_scroller && gtk_widget_get_visible(thumb_scroller);
+}
+
+static void thumb_strip_changed(void) {
+    if (thumb_strip_shown()) gtk_widget_queue_draw(thumb_strip);
+}
 
-    if (!page_surface) return;
+static void on_thumbs_scrolled(GtkAdjustment *adj, gpointer data) {
+    if (!thumb_strip_shown() || !thumbs_n) return;
+    int first, last;
+    thumb_visible_rows(&first, &last);
+    thumbs_request(first, last + 2);
+    gtk_widget_queue_draw(thumb_strip);
+}
 
-    double ox = (w > page_w) ? (w - page_w) / 2.0 : 0;
-    double oy = (h > page_h) ? (h - page_h) / 2.0 : 0;
+// Keeps the current page's row in view and the strip as long as the
+// document, and its rows requested. Called from update_ui().
+static void thumb_strip_follow(void) {
+    static int rows = 0;
+    if (!thumb_strip) return;
+    if (rows != thumbs_n) {
+        rows = thumbs_n;
+        gtk_widget_queue_resize(thumb_strip);
+    }
+    if (!thumb_strip_shown() || !doc || current_page >= thumbs_n) return;
+
+    GtkAdjustment *vadj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(thumb_scroller));
+    double y = gtk_adjustment_get_value(vadj), size = gtk_adjustment_get_page_size(vadj);
+    double top = (double)current_page * THUMB_ROW;
+    if (top < y)                          gtk_adjustment_set_value(vadj, top);
+    else if (top + THUMB_ROW > y + size)  gtk_adjustment_set_value(vadj, top + THUMB_ROW - size);
+    on_thumbs_scrolled(NULL, NULL);
+}
 
-    cairo_set_source_surface(cr, page_surface, ox, oy);
-    cairo_paint(cr);
+static void on_thumb_pressed(GtkGestureClick *gesture, int n_press, double x, double y, gpointer data) {
+    int page = (int)(y / THUMB_ROW);
+    if (!doc || page < 0 || page >= thumbs_n) return;
+    go_to_page(page - current_page);
+}
 
-    // --- NEO-BRUTALIST SELECTION DRAWING ---
-    if (doc && (selection_rect.x1 > selection_rect.x0 || selection_rect.y1 > selection_rect.y0)) {
-        double sx0 = selection_rect.x0 * zoom_factor + ox;
-        double sy0 = selection_rect.y0 * zoom_factor + oy;
-        double sx1 = selection_rect.x1 * zoom_factor + ox;
-        double sy1 = selection_rect.y1 * zoom_factor + oy;
+static void on_toggle_thumbs(GtkWidget *w, gpointer data) {
+    gtk_widget_set_visible(thumb_scroller, !gtk_widget_get_visible(thumb_scroller));
+    if (!thumb_strip_shown()) {
+        thumb_textures_keep(0, -1);
+        return;
+    }
+    thumb_strip_follow();
+}
 
-        double sel_w = sx1 - sx0;
-        double sel_h = sy1 - sy0;
+static void guf_thumb_strip_snapshot(GtkWidget *widget, GtkSnapshot *snap) {
+    if (!doc || !thumbs_n) return;
+    int first, last;
+    thumb_visible_rows(&first, &last);
+
+    for (int p = first; p <= last; p++) {
+        double cy = (double)p * THUMB_ROW + THUMB_PAD;
+        thumb *t = &thumbs[p];
+        // Unrendered rows show a blank sheet of the page's proportions
+        // when they are known, else of the box.
+        double w = THUMB_W, h = THUMB_H;
+        if (t->pixels) {
+            w = t->w; h = t->h;
+        } else if (page_bounds_known[p]) {
+            fz_rect b = page_bounds[p];
+            double scale = fmin(THUMB_W / (b.x1 - b.x0), THUMB_H / (b.y1 - b.y0));
+            w = (b.x1 - b.x0) * scale; h = (b.y1 - b.y0) * scale;
+        }
+        double x = THUMB_PAD + (THUMB_W - w) / 2.0;
+        double y = cy + (THUMB_H - h) / 2.0;
+
+        snapshot_rect(snap, &color_white, x, y, w, h);
+        GdkTexture *tex = thumb_texture(p);
+        if (tex) gtk_snapshot_append_texture(snap, tex, &GRAPHENE_RECT_INIT(x, y, w, h));
+        if (p == current_page) snapshot_frame(snap, &color_current, x, y, w, h, 4.0);
+        else                   snapshot_frame(snap, &color_black, x, y, w, h, 2.0);
+    }
+    thumb_textures_keep(MAX(first - 2, 0), last + 2);
+}
 
-        cairo_rectangle(cr, sx0, sy0, sel_w, sel_h);
+static void guf_thumb_strip_measure(GtkWidget *widget, GtkOrientation orientation, int for_size,
+                                    int *minimum, int *natural, int *minimum_baseline, int *natural_baseline) {
+    *minimum = *natural = (orientation == GTK_ORIENTATION_HORIZONTAL) ? THUMB_STRIP : thumbs_n * THUMB_ROW;
+}
 
-        // High Contrast Neon Pink Fill
-        cairo_set_source_rgba(cr, 1.0, 0.0, 0.8, 0.4);
-        cairo_fill_preserve(cr);
+static void guf_thumb_strip_class_init(GufThumbStripClass *klass) {
+    GtkWidgetClass *widget_class = GTK_WIDGET_CLASS(klass);
+    widget_class->snapshot = guf_thumb_strip_snapshot;
+    widget_class->measure  = guf_thumb_strip_measure;
+    gtk_widget_class_set_css_name(widget_class, "thumbstrip");
+}
 
-        // Thick Black Border
-        cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
-        cairo_set_line_width(cr, 3.0);
-        cairo_stroke(cr);
-    }
+static void guf_thumb_strip_init(GufThumbStrip *strip) {
 }
 
 /* ---------- KEYBOARD SHORTCUTS & SCROLLING ---------- */
@@ -465,6 +3360,18 @@ static gboolean on_key_pressed(GtkEventControllerKey *kc, guint keyval, guint ke
     if (keyval == GDK_KEY_o && (state & GDK_CONTROL_MASK)) {
         on_open(NULL, NULL); return TRUE;
     }
+    if (keyval == GDK_KEY_f && (state & GDK_CONTROL_MASK)) {
+        on_find(NULL, NULL); return TRUE;
+    }
+    if (state & GDK_CONTROL_MASK) {
+        switch (keyval) {
+            case GDK_KEY_w:            tab_close_active(); return TRUE;
+            case GDK_KEY_Tab:
+            case GDK_KEY_Page_Down:    tab_step(state & GDK_SHIFT_MASK ? -1 : 1); return TRUE;
+            case GDK_KEY_ISO_Left_Tab:
+            case GDK_KEY_Page_Up:      tab_step(-1); return TRUE;
+        }
+    }
     switch (keyval) {
         /* WASD PANNING */
         case GDK_KEY_w:
@@ -495,15 +3402,52 @@ static gboolean on_key_pressed(GtkEventControllerKey *kc, guint keyval, guint ke
         case GDK_KEY_KP_Subtract: on_zoom_out(NULL, NULL); return TRUE;
 
         case GDK_KEY_b:          on_toggle_bookmark(NULL, NULL); return TRUE;
+        case GDK_KEY_c:          on_toggle_layout(NULL, NULL); return TRUE;
+        case GDK_KEY_f:          on_cycle_fit(NULL, NULL); return TRUE;
+        case GDK_KEY_t:          on_toggle_thumbs(NULL, NULL); return TRUE;
+        case GDK_KEY_i:          page_cache_report(); return TRUE;
+        case GDK_KEY_h:          on_toggle_hud(NULL, NULL); return TRUE;
         case GDK_KEY_g:          if (state & GDK_CONTROL_MASK) { on_go_to_bookmark(NULL, NULL); return TRUE; } return FALSE;
         default:                 return FALSE;
     }
 }
 
+// Runs before startup, so the budget is final when the context is made.
+static gint on_handle_local_options(GApplication *app, GVariantDict *opts, gpointer data) {
+    gint cache_mb;
+    if (g_variant_dict_lookup(opts, "cache-mb", "i", &cache_mb) && cache_mb >= 0)
+        cache_budget = (size_t)cache_mb << 20;
+    if (g_variant_dict_contains(opts, "mmap"))
+        open_mapped = 1;
+    return -1;
+}
+
+// Runs in the primary instance for every launch, its own and those of
+// later `guf` processes, which GApplication forwards over D-Bus and which
+// exit once this returns. Relative paths resolve against the launching
+// process's directory.
 static int on_command_line(GApplication *app, GApplicationCommandLine *cmdline, gpointer data) {
     int argc;
     char **argv = g_application_command_line_get_arguments(cmdline, &argc);
-    if (argc > 1) initial_file = g_strdup(argv[1]);
+    GVariantDict *opts = g_application_command_line_get_options_dict(cmdline);
+    if (!daemon_mode && g_variant_dict_contains(opts, "daemon")) {
+        daemon_mode = 1;
+        g_application_hold(app);
+        if (argc < 2) {
+            if (!main_window) build_window(GTK_APPLICATION(app));
+            g_strfreev(argv);
+            return 0;
+        }
+    }
+    if (argc > 1) {
+        g_strfreev(initial_files);
+        initial_files = g_new0(char *, argc);
+        for (int i = 1; i < argc; i++) {
+            GFile *file = g_application_command_line_create_file_for_arg(cmdline, argv[i]);
+            initial_files[i - 1] = file_location(file);
+            g_object_unref(file);
+        }
+    }
     g_strfreev(argv);
     g_application_activate(app);
     return 0;
@@ -554,6 +3498,18 @@ static void load_css(void) {
         "  color: white;"
         "  padding: 6px 12px;"
         "  border-radius: 0px;"
+        "}"
+        "button.tab {"
+        "  padding: 4px 12px;"
+        "  box-shadow: 3px 3px 0px black;"
+        "}"
+        "button.tab.active {"
+        "  background-color: #FFF700;"
+        "}"
+        "label.hud {"
+        "  font-size: 11px;"
+        "  background-color: #FF6B6B;"
+        "  color: black;"
         "}";
 
     gtk_css_provider_load_from_data(provider, neo_css, -1);
@@ -565,10 +3521,42 @@ static void load_css(void) {
 }
 
 /* ---------- GTK Activate ---------- */
-static void activate(GtkApplication *app, gpointer data) {
-    load_css();
+// With --daemon the primary instance starts with the window built but
+// hidden, and closing the window closes its tabs and hides it again
+// instead of quitting.
+static gboolean on_close_request(GtkWindow *win, gpointer data) {
+    if (!daemon_mode) return FALSE;
+    tabs_close_all();
+    gtk_widget_set_visible(GTK_WIDGET(win), FALSE);
+    return TRUE;
+}
+
+// Render jobs, search and geometry batches and open results still in
+// flight are delivered while main() stops the pools, after the widgets
+// are gone: every generation is bumped so they are dropped on arrival,
+// and the view's timers are stopped.
+static void on_window_destroy(GtkWidget *win, gpointer data) {
+    shutting_down = 1;
+    search_generation++;
+    geometry_generation++;
+    open_generation++;
+    g_atomic_int_inc(&render_generation);
+    g_atomic_int_inc(&thumb_generation);
+    render_cancel_stale();
+
+    guint *timers[] = { &settle_id, &resize_id, &prefetch_id, &interaction_id, &scroll_settle_id };
+    for (guint i = 0; i < G_N_ELEMENTS(timers); i++) {
+        if (*timers[i]) g_source_remove(*timers[i]);
+        *timers[i] = 0;
+    }
+    main_window = NULL;
+}
 
+static void build_window(GtkApplication *app) {
     GtkWidget *win = gtk_application_window_new(app);
+    main_window = win;
+    g_signal_connect(win, "close-request", G_CALLBACK(on_close_request), NULL);
+    g_signal_connect(win, "destroy", G_CALLBACK(on_window_destroy), NULL);
     gtk_window_set_title(GTK_WINDOW(win), "NEO_READER_V2 [SCROLL_RESET]");
     gtk_window_set_default_size(GTK_WINDOW(win), 1100, 800);
 
@@ -579,6 +3567,59 @@ static void activate(GtkApplication *app, gpointer data) {
     GtkWidget *vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
     gtk_window_set_child(GTK_WINDOW(win), vbox);
 
+    search_bar = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 15);
+    gtk_widget_set_margin_start(search_bar, 20);
+    gtk_widget_set_margin_end(search_bar, 20);
+    gtk_widget_set_margin_top(search_bar, 20);
+    gtk_widget_set_visible(search_bar, FALSE);
+    gtk_box_append(GTK_BOX(vbox), search_bar);
+
+    search_entry = gtk_search_entry_new();
+    gtk_widget_set_hexpand(search_entry, TRUE);
+    GtkWidget *bhprev = gtk_button_new_with_label("PREV HIT");
+    GtkWidget *bhnext = gtk_button_new_with_label("NEXT HIT");
+    search_label = gtk_label_new("");
+    gtk_box_append(GTK_BOX(search_bar), search_entry);
+    gtk_box_append(GTK_BOX(search_bar), bhprev);
+    gtk_box_append(GTK_BOX(search_bar), bhnext);
+    gtk_box_append(GTK_BOX(search_bar), search_label);
+
+    g_signal_connect(search_entry, "search-changed", G_CALLBACK(on_search_changed), NULL);
+    g_signal_connect(search_entry, "activate", G_CALLBACK(on_search_next), NULL);
+    g_signal_connect(search_entry, "next-match", G_CALLBACK(on_search_next), NULL);
+    g_signal_connect(search_entry, "previous-match", G_CALLBACK(on_search_prev), NULL);
+    g_signal_connect(search_entry, "stop-search", G_CALLBACK(on_search_stop), NULL);
+    g_signal_connect(bhprev, "clicked", G_CALLBACK(on_search_prev), NULL);
+    g_signal_connect(bhnext, "clicked", G_CALLBACK(on_search_next), NULL);
+
+    tab_bar = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+    gtk_widget_set_margin_start(tab_bar, 20);
+    gtk_widget_set_margin_end(tab_bar, 20);
+    gtk_widget_set_margin_top(tab_bar, 20);
+    gtk_widget_set_visible(tab_bar, FALSE);
+    gtk_box_append(GTK_BOX(vbox), tab_bar);
+
+    GtkWidget *hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+    gtk_widget_set_vexpand(hbox, TRUE);
+    gtk_box_append(GTK_BOX(vbox), hbox);
+
+    thumb_scroller = gtk_scrolled_window_new();
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(thumb_scroller), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+    gtk_widget_set_margin_start(thumb_scroller, 20);
+    gtk_widget_set_margin_top(thumb_scroller, 20);
+    gtk_widget_set_visible(thumb_scroller, FALSE);
+    gtk_box_append(GTK_BOX(hbox), thumb_scroller);
+
+    thumb_strip = g_object_new(GUF_TYPE_THUMB_STRIP, NULL);
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(thumb_scroller), thumb_strip);
+    GtkAdjustment *tadj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(thumb_scroller));
+    g_signal_connect(tadj, "value-changed", G_CALLBACK(on_thumbs_scrolled), NULL);
+    g_signal_connect(tadj, "changed", G_CALLBACK(on_thumbs_scrolled), NULL);
+
+    GtkGesture *thumb_click = gtk_gesture_click_new();
+    gtk_widget_add_controller(thumb_strip, GTK_EVENT_CONTROLLER(thumb_click));
+    g_signal_connect(thumb_click, "pressed", G_CALLBACK(on_thumb_pressed), NULL);
+
     GtkWidget *sc = gtk_scrolled_window_new();
     gtk_widget_set_hexpand(sc, TRUE);
     gtk_widget_set_vexpand(sc, TRUE);
@@ -586,13 +3627,28 @@ static void activate(GtkApplication *app, gpointer data) {
     gtk_widget_set_margin_start(sc, 20);
     gtk_widget_set_margin_end(sc, 20);
     gtk_widget_set_margin_top(sc, 20);
-    gtk_box_append(GTK_BOX(vbox), sc);
+    gtk_box_append(GTK_BOX(hbox), sc);
 
-    drawing_area = gtk_drawing_area_new();
-    gtk_drawing_area_set_draw_func(GTK_DRAWING_AREA(drawing_area), draw_cb, NULL, NULL);
+    drawing_area = g_object_new(GUF_TYPE_PAGE_VIEW, NULL);
     gtk_widget_set_size_request(drawing_area, 1, 1);
+    g_signal_connect(drawing_area, "realize", G_CALLBACK(on_view_realize), NULL);
+    g_signal_connect(drawing_area, "realize", G_CALLBACK(on_view_realize_scale), NULL);
+    g_signal_connect(drawing_area, "notify::scale-factor", G_CALLBACK(on_scale_changed), NULL);
     gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(sc), drawing_area);
 
+    // Scrolling and viewport resizes expose new tiles at high zoom.
+    GtkAdjustment *hadj = gtk_scrolled_window_get_hadjustment(GTK_SCROLLED_WINDOW(sc));
+    GtkAdjustment *vadj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(sc));
+    g_signal_connect(hadj, "value-changed", G_CALLBACK(on_view_value_changed), NULL);
+    g_signal_connect(vadj, "value-changed", G_CALLBACK(on_view_value_changed), NULL);
+    g_signal_connect(hadj, "changed", G_CALLBACK(on_view_scrolled), NULL);
+    g_signal_connect(vadj, "changed", G_CALLBACK(on_view_scrolled), NULL);
+    g_signal_connect(hadj, "changed", G_CALLBACK(on_search_layout_changed), NULL);
+    g_signal_connect(vadj, "changed", G_CALLBACK(on_search_layout_changed), NULL);
+    g_signal_connect(vadj, "changed", G_CALLBACK(on_continuous_layout_changed), NULL);
+    g_signal_connect(hadj, "changed", G_CALLBACK(on_viewport_changed), NULL);
+    g_signal_connect(vadj, "changed", G_CALLBACK(on_viewport_changed), NULL);
+
     GtkGesture *drag_gesture = gtk_gesture_drag_new();
     gtk_gesture_single_set_button(GTK_GESTURE_SINGLE(drag_gesture), GDK_BUTTON_PRIMARY);
     gtk_widget_add_controller(drawing_area, GTK_EVENT_CONTROLLER(drag_gesture));
@@ -613,6 +3669,9 @@ static void activate(GtkApplication *app, gpointer data) {
     GtkWidget *bzi   = gtk_button_new_with_label("ZOOM +");
     GtkWidget *bzo   = gtk_button_new_with_label("ZOOM -");
     bookmark_btn     = gtk_button_new_with_label("MARK (B)");
+    layout_btn       = gtk_button_new_with_label("SCROLL (C)");
+    fit_btn          = gtk_button_new_with_label(zoom_mode_labels[zoom_mode]);
+    GtkWidget *bthumbs = gtk_button_new_with_label("PAGES (T)");
     page_label       = gtk_label_new("NO DATA");
 
     gtk_box_append(GTK_BOX(bar), bopen);
@@ -620,43 +3679,139 @@ static void activate(GtkApplication *app, gpointer data) {
     gtk_box_append(GTK_BOX(bar), bnext);
     gtk_box_append(GTK_BOX(bar), bzi);
     gtk_box_append(GTK_BOX(bar), bzo);
+    gtk_box_append(GTK_BOX(bar), fit_btn);
     gtk_box_append(GTK_BOX(bar), bookmark_btn);
+    gtk_box_append(GTK_BOX(bar), layout_btn);
+    gtk_box_append(GTK_BOX(bar), bthumbs);
 
     gtk_widget_set_hexpand(page_label, TRUE);
     gtk_label_set_xalign(GTK_LABEL(page_label), 1.0f);
     gtk_box_append(GTK_BOX(bar), page_label);
 
+    hud_label = gtk_label_new("");
+    gtk_widget_add_css_class(hud_label, "hud");
+    gtk_widget_set_visible(hud_label, hud_shown);
+    gtk_box_append(GTK_BOX(bar), hud_label);
+
     g_signal_connect(bopen, "clicked", G_CALLBACK(on_open), NULL);
     g_signal_connect(bprev, "clicked", G_CALLBACK(on_prev), NULL);
     g_signal_connect(bnext, "clicked", G_CALLBACK(on_next), NULL);
     g_signal_connect(bzi,   "clicked", G_CALLBACK(on_zoom_in), NULL);
     g_signal_connect(bzo,   "clicked", G_CALLBACK(on_zoom_out), NULL);
+    g_signal_connect(fit_btn, "clicked", G_CALLBACK(on_cycle_fit), NULL);
     g_signal_connect(bookmark_btn, "clicked", G_CALLBACK(on_toggle_bookmark), NULL);
+    g_signal_connect(layout_btn,   "clicked", G_CALLBACK(on_toggle_layout), NULL);
+    g_signal_connect(bthumbs,      "clicked", G_CALLBACK(on_toggle_thumbs), NULL);
 
-    gtk_widget_show(win);
+    tabs_init();
+    update_ui();
+}
 
-    if (initial_file && ctx) {
-        open_pdf(initial_file);
-        g_free(initial_file);
-        initial_file = NULL;
-    } else {
-        update_ui();
+// Later launches end up here in this, the primary, instance (see
+// on_command_line), so the window is built once and their files join
+// it as tabs, on the context, caches and workers that are already warm.
+static void activate(GtkApplication *app, gpointer data) {
+    if (!main_window) build_window(app);
+    if (initial_files && ctx) {
+        for (char **f = initial_files; *f; f++)
+            tab_open(*f);
+        g_strfreev(initial_files);
+        initial_files = NULL;
     }
+    gtk_window_present(GTK_WINDOW(main_window));
 }
 
-int main(int argc, char **argv) {
-    ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
-    if (!ctx) return 1;
+// The store limit cannot change once the context exists, so MuPDF is set
+// up here rather than in main(), after the command line is parsed.
+static void on_startup(GApplication *app, gpointer data) {
+    ctx = fz_new_context(&render_alloc, &render_locks, store_limit());
+    if (!ctx) {
+        fprintf(stderr, "Cannot create MuPDF context\n");
+        g_application_quit(app);
+        return;
+    }
     fz_register_document_handlers(ctx);
+    render_pool_start(ctx, render_job_done);
+    load_css();
+}
+
+int main(int argc, char **argv) {
+    const char *direct_env = g_getenv("GUF_DIRECT_RENDER");
+    if (direct_env && atoi(direct_env) == 0) direct_render = 0;
+    convert_init();
+    page_cache_init(g_object_unref);
+    pending_jobs = g_hash_table_new(cache_key_hash, cache_key_equal);
+    text_pending = g_hash_table_new(g_direct_hash, g_direct_equal);
+    thumb_pending = g_hash_table_new(g_direct_hash, g_direct_equal);
+    selection_lines = g_array_new(FALSE, FALSE, sizeof(fz_rect));
+    search_index   = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_array_unref);
+    search_matches = g_array_new(FALSE, FALSE, sizeof(search_match));
+    search_rects   = g_array_new(FALSE, FALSE, sizeof(fz_rect));
+    const char *prefetch_env = g_getenv("GUF_PREFETCH");
+    if (prefetch_env) prefetch_depth = atoi(prefetch_env);
+    const char *mmap_env = g_getenv("GUF_MMAP");
+    if (mmap_env) open_mapped = atoi(mmap_env) != 0;
+    const char *lowres_env = g_getenv("GUF_SCROLL_LOWRES");
+    if (lowres_env && atoi(lowres_env) == 0) scroll_lowres = 0;
+    const char *draft_env = g_getenv("GUF_DRAFT");
+    if (draft_env) draft_renders = atoi(draft_env) != 0;
+    const char *aa_env = g_getenv("GUF_AA");
+    if (aa_env) {
+        int bits = CLAMP(atoi(aa_env), 0, 8);
+        render_profiles[RENDER_QUALITY_FULL].text_aa     = bits;
+        render_profiles[RENDER_QUALITY_FULL].graphics_aa = bits;
+    }
+    const char *hud_env = g_getenv("GUF_HUD");
+    if (hud_env) hud_shown = atoi(hud_env) != 0;
+    trace_open(g_getenv("GUF_TRACE"));
 
     GtkApplication *app = gtk_application_new("com.neo.pdf", G_APPLICATION_HANDLES_COMMAND_LINE);
+    g_signal_connect(app, "handle-local-options", G_CALLBACK(on_handle_local_options), NULL);
+    g_signal_connect(app, "startup", G_CALLBACK(on_startup), NULL);
     g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
     g_signal_connect(app, "command-line", G_CALLBACK(on_command_line), NULL);
+    g_application_add_main_option(G_APPLICATION(app), "cache-mb", 0, G_OPTION_FLAG_NONE,
+                                  G_OPTION_ARG_INT, "Memory budget for MuPDF and the page cache, in megabytes", "MB");
+    g_application_add_main_option(G_APPLICATION(app), "mmap", 0, G_OPTION_FLAG_NONE,
+                                  G_OPTION_ARG_NONE, "Memory-map local documents instead of reading them", NULL);
+    g_application_add_main_option(G_APPLICATION(app), "daemon", 0, G_OPTION_FLAG_NONE,
+                                  G_OPTION_ARG_NONE, "Keep running in the background so files open at once", NULL);
 
     int status = g_application_run(G_APPLICATION(app), argc, argv);
+    if (!ctx) {
+        g_object_unref(app);
+        return status;
+    }
 
+    open_threads_join();
+    doc_cache_save();
+    geometry_stop();
+    search_index_stop();
+    doc_cache_wait_saved();
+    doc_cache_unload();
+    render_pool_stop();
+    const char *stats_env = g_getenv("GUF_CACHE_STATS");
+    if (stats_env && atoi(stats_env)) page_cache_report();
+    page_cache_clear();
+    list_cache_clear();
+    text_cache_clear();
+    g_hash_table_destroy(text_pending);
+    thumbs_reset(0);
+    g_hash_table_destroy(thumb_pending);
+    g_array_free(selection_lines, TRUE);
+    g_hash_table_destroy(search_index);
+    g_array_free(search_matches, TRUE);
+    g_array_free(search_rects, TRUE);
+    g_strfreev(search_terms);
     if (doc) fz_drop_document(ctx, doc);
+    if (tabs) {
+        for (guint i = 0; i < tabs->len; i++)
+            tab_free(g_ptr_array_index(tabs, i));
+        g_ptr_array_unref(tabs);
+    }
     free_page_surface();
+    g_free(page_bounds);
+    g_free(page_bounds_known);
     fz_drop_context(ctx);
     g_free(current_path);
     g_object_unref(app);
@@ -0,0 +1,1019 @@
+#include "render.h"
+#include "convert.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* ---------- Memory Budget ---------- */
+// One budget (--cache-mb / GUF_CACHE_MB) covers both MuPDF and our caches.
+// MuPDF's resource store (fonts, images, decoded streams) gets a fixed
+// share of it, which MuPDF enforces itself. Everything MuPDF allocates is
+// counted through a wrapping allocator, and the page surface cache yields
+// to it: it may only use what the budget has left after MuPDF's current
+// usage, so a doc with heavy images keeps fewer rendered pages around
+// rather than growing past the budget.
+#define CACHE_DEFAULT_MB 256
+#define STORE_SHARE      4      // the store may use 1/STORE_SHARE of the budget
+#define STORE_MIN_BYTES  ((size_t)16 << 20)
+
+size_t       cache_budget  = (size_t)CACHE_DEFAULT_MB << 20;
+static gsize fz_heap_bytes = 0;  // live MuPDF allocations, atomic
+
+typedef union alloc_header {
+    size_t      size;
+    max_align_t align;
+} alloc_header;
+
+static void *fz_heap_malloc(void *user, size_t size) {
+    alloc_header *h = malloc(sizeof(*h) + size);
+    if (!h) return NULL;
+    h->size = size;
+    g_atomic_pointer_add(&fz_heap_bytes, (gssize)size);
+    return h + 1;
+}
+
+static void *fz_heap_realloc(void *user, void *old, size_t size) {
+    if (!old) return fz_heap_malloc(user, size);
+    alloc_header *h = (alloc_header *)old - 1;
+    size_t old_size = h->size;
+    h = realloc(h, sizeof(*h) + size);
+    if (!h) return NULL;
+    h->size = size;
+    g_atomic_pointer_add(&fz_heap_bytes, (gssize)size - (gssize)old_size);
+    return h + 1;
+}
+
+static void fz_heap_free(void *user, void *ptr) {
+    if (!ptr) return;
+    alloc_header *h = (alloc_header *)ptr - 1;
+    g_atomic_pointer_add(&fz_heap_bytes, -(gssize)h->size);
+    free(h);
+}
+
+fz_alloc_context render_alloc = { NULL, fz_heap_malloc, fz_heap_realloc, fz_heap_free };
+
+size_t store_limit(void) {
+    return MAX(cache_budget / STORE_SHARE, STORE_MIN_BYTES);
+}
+
+size_t mupdf_bytes(void) {
+    return (size_t)g_atomic_pointer_get(&fz_heap_bytes);
+}
+
+static gsize pool_idle_bytes = 0;  // atomic; see Pixel Buffer Pool
+
+// What the page surface cache may hold right now. MuPDF's claim is capped
+// at half the budget so a transient spike cannot empty the cache; the
+// pool's idle buffers are capped at 1/POOL_SHARE of it.
+size_t page_cache_limit(void) {
+    return cache_budget - MIN(mupdf_bytes(), cache_budget / 2) - (size_t)g_atomic_pointer_get(&pool_idle_bytes);
+}
+
+/* ---------- Pixel Buffer Pool ---------- */
+// Surfaces and scratch pixmaps are large, short-lived and come in few
+// sizes (tiles, and whole pages at the zoom being read), so their buffers
+// are recycled: left to malloc, each would be mapped and unmapped again.
+// Sizes are rounded up to classes a quarter of a power of two apart, so at
+// most a quarter is slack. Returned buffers wait on their class's free
+// list; those idle bytes come out of the page cache's share of the budget
+// and are capped at 1/POOL_SHARE of it, past which buffers really are
+// freed. Sizes beyond the largest class bypass the pool.
+#define POOL_MIN_SHIFT 16   // smallest class: 64 KB
+#define POOL_MAX_SHIFT 32
+#define POOL_CLASSES   (4 * (POOL_MAX_SHIFT - POOL_MIN_SHIFT) + 1)
+#define POOL_SHARE     8
+
+static GMutex  pool_lock;
+static GSList *pool_free[POOL_CLASSES];
+static guint   pool_hits   = 0;
+static guint   pool_misses = 0;
+
+// Class 0 is everything up to 2^POOL_MIN_SHIFT; above that, sizes in
+// (2^s, 2^(s+1)] fall in four classes of 2^(s-2) each.
+static int pool_class(size_t size, size_t *class_size) {
+    if (size <= ((size_t)1 << POOL_MIN_SHIFT)) {
+        *class_size = (size_t)1 << POOL_MIN_SHIFT;
+        return 0;
+    }
+    int shift = (int)g_bit_storage(size - 1) - 1;
+    size_t step = (size_t)1 << (shift - 2);
+    size_t q = (size - ((size_t)1 << shift) + step - 1) / step;
+    *class_size = ((size_t)1 << shift) + q * step;
+    return (shift - POOL_MIN_SHIFT) * 4 + (int)q;
+}
+
+void *pixel_buffer_get(size_t size, size_t *class_size) {
+    int c = pool_class(size, class_size);
+    if (c >= POOL_CLASSES) {
+        *class_size = size;
+        return g_try_malloc(size);
+    }
+
+    g_mutex_lock(&pool_lock);
+    void *data = pool_free[c] ? pool_free[c]->data : NULL;
+    if (data) {
+        pool_free[c] = g_slist_delete_link(pool_free[c], pool_free[c]);
+        g_atomic_pointer_add(&pool_idle_bytes, -(gssize)*class_size);
+        pool_hits++;
+    } else {
+        pool_misses++;
+    }
+    g_mutex_unlock(&pool_lock);
+    return data ? data : g_try_malloc(*class_size);
+}
+
+void pixel_buffer_put(void *data, size_t class_size) {
+    size_t rounded;
+    int c = pool_class(class_size, &rounded);
+    if (!data) return;
+
+    g_mutex_lock(&pool_lock);
+    int keep = c < POOL_CLASSES && rounded == class_size &&
+               (size_t)g_atomic_pointer_get(&pool_idle_bytes) + class_size <= cache_budget / POOL_SHARE;
+    if (keep) {
+        pool_free[c] = g_slist_prepend(pool_free[c], data);
+        g_atomic_pointer_add(&pool_idle_bytes, (gssize)class_size);
+    }
+    g_mutex_unlock(&pool_lock);
+    if (!keep) g_free(data);
+}
+
+typedef struct pooled_buffer {
+    void  *data;
+    size_t size;
+} pooled_buffer;
+
+static const cairo_user_data_key_t pool_key;
+
+static void pooled_surface_release(void *p) {
+    pooled_buffer *b = p;
+    pixel_buffer_put(b->data, b->size);
+    g_free(b);
+}
+
+cairo_surface_t *pixel_surface_new(int w, int h) {
+    int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, w);
+    if (stride <= 0 || h <= 0) return NULL;
+
+    pooled_buffer *b = g_new(pooled_buffer, 1);
+    b->data = pixel_buffer_get((size_t)stride * h, &b->size);
+    if (!b->data) {
+        g_free(b);
+        return NULL;
+    }
+    cairo_surface_t *surface = cairo_image_surface_create_for_data(b->data, CAIRO_FORMAT_ARGB32, w, h, stride);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS ||
+        cairo_surface_set_user_data(surface, &pool_key, b, pooled_surface_release) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(surface);
+        pooled_surface_release(b);
+        return NULL;
+    }
+    return surface;
+}
+
+size_t pixel_surface_bytes(cairo_surface_t *surface) {
+    pooled_buffer *b = cairo_surface_get_user_data(surface, &pool_key);
+    return b ? b->size : (size_t)cairo_image_surface_get_stride(surface) * cairo_image_surface_get_height(surface);
+}
+
+/* ---------- Page Surface Cache ---------- */
+// Rendered surfaces keyed by (page, zoom bucket, tile), evicted
+// least-recently-used once the total pixel memory exceeds
+// page_cache_limit(). Whole-page surfaces use tile (-1, -1). Each entry
+// can also carry an attachment derived from its surface, released with
+// it through attachment_free. Main thread only.
+typedef struct cache_entry {
+    cache_key        key;
+    cairo_surface_t *surface;
+    gpointer         attachment;
+    size_t           bytes;
+    GList            link;
+} cache_entry;
+
+static GHashTable    *cache_table     = NULL;
+static GQueue         cache_lru       = G_QUEUE_INIT;
+static size_t         cache_bytes     = 0;
+static guint          cache_hits      = 0;
+static guint          cache_misses    = 0;
+static GDestroyNotify attachment_free = NULL;
+
+guint cache_key_hash(gconstpointer p) {
+    const cache_key *k = p;
+    return (((guint)k->page * 31u + (guint)k->zoom) * 31u + (guint)k->tx) * 31u + (guint)k->ty;
+}
+
+gboolean cache_key_equal(gconstpointer a, gconstpointer b) {
+    const cache_key *ka = a, *kb = b;
+    return ka->page == kb->page && ka->zoom == kb->zoom &&
+           ka->tx == kb->tx && ka->ty == kb->ty;
+}
+
+cache_key make_tile_key(int page, float zoom, int tx, int ty) {
+    return (cache_key){ page, (int)lroundf(zoom * 1000.0f), tx, ty };
+}
+
+cache_key make_cache_key(int page, float zoom) {
+    return make_tile_key(page, zoom, -1, -1);
+}
+
+static void cache_entry_free(gpointer data) {
+    cache_entry *e = data;
+    if (e->attachment && attachment_free) attachment_free(e->attachment);
+    cairo_surface_destroy(e->surface);
+    g_free(e);
+}
+
+void page_cache_init(GDestroyNotify free_attachment) {
+    const char *env = g_getenv("GUF_CACHE_MB");
+    if (env) cache_budget = (size_t)g_ascii_strtoull(env, NULL, 10) << 20;
+    attachment_free = free_attachment;
+    cache_table = g_hash_table_new_full(cache_key_hash, cache_key_equal, NULL, cache_entry_free);
+}
+
+static void page_cache_remove(cache_entry *e) {
+    g_queue_unlink(&cache_lru, &e->link);
+    cache_bytes -= e->bytes;
+    g_hash_table_remove(cache_table, &e->key);
+}
+
+void page_cache_clear(void) {
+    g_queue_init(&cache_lru);
+    g_hash_table_remove_all(cache_table);
+    cache_bytes = 0;
+}
+
+cairo_surface_t *page_cache_peek(cache_key key) {
+    cache_entry *e = g_hash_table_lookup(cache_table, &key);
+    if (!e) return NULL;
+    g_queue_unlink(&cache_lru, &e->link);
+    g_queue_push_head_link(&cache_lru, &e->link);
+    return e->surface;
+}
+
+cairo_surface_t *page_cache_lookup(cache_key key) {
+    cairo_surface_t *surface = page_cache_peek(key);
+    if (surface) cache_hits++;
+    else cache_misses++;
+    return surface;
+}
+
+void page_cache_insert(cache_key key, cairo_surface_t *surface) {
+    size_t bytes = pixel_surface_bytes(surface);
+    size_t limit = page_cache_limit();
+    if (bytes > limit) return;
+
+    cache_entry *old = g_hash_table_lookup(cache_table, &key);
+    if (old) page_cache_remove(old);
+
+    while (cache_bytes + bytes > limit && cache_lru.tail)
+        page_cache_remove(cache_lru.tail->data);
+
+    cache_entry *e = g_new0(cache_entry, 1);
+    e->key       = key;
+    e->surface   = cairo_surface_reference(surface);
+    e->bytes     = bytes;
+    e->link.data = e;
+    g_queue_push_head_link(&cache_lru, &e->link);
+    g_hash_table_insert(cache_table, &e->key, e);
+    cache_bytes += bytes;
+}
+
+int page_cache_contains(cache_key key) {
+    return g_hash_table_contains(cache_table, &key);
+}
+
+int page_cache_is_draft(cache_key key) {
+    cache_entry *e = g_hash_table_lookup(cache_table, &key);
+    return e && render_surface_is_draft(e->surface);
+}
+
+cairo_surface_t *page_cache_closest(int page, float zoom, float *found_zoom) {
+    cache_entry *best = NULL;
+    double best_dist = 0.0;
+    int target = make_cache_key(page, zoom).zoom;
+
+    GHashTableIter it;
+    gpointer value;
+    g_hash_table_iter_init(&it, cache_table);
+    while (g_hash_table_iter_next(&it, NULL, &value)) {
+        cache_entry *e = value;
+        if (e->key.page != page || e->key.tx >= 0 || e->key.zoom <= 0) continue;
+        double dist = fabs(log((double)e->key.zoom / target));
+        if (!best || dist < best_dist) {
+            best = e;
+            best_dist = dist;
+        }
+    }
+    if (!best) return NULL;
+    *found_zoom = best->key.zoom / 1000.0f;
+    return best->surface;
+}
+
+gpointer *page_cache_attachment(cache_key key, cairo_surface_t *surface) {
+    cache_entry *e = g_hash_table_lookup(cache_table, &key);
+    return (e && e->surface == surface) ? &e->attachment : NULL;
+}
+
+void page_cache_report(void) {
+    fprintf(stderr, "page cache: %u hits, %u misses, %zu KB in use (limit %zu KB)\n",
+            cache_hits, cache_misses, cache_bytes >> 10, page_cache_limit() >> 10);
+    fprintf(stderr, "mupdf: %zu KB allocated, store limit %zu KB, budget %zu KB\n",
+            mupdf_bytes() >> 10, store_limit() >> 10, cache_budget >> 10);
+    g_mutex_lock(&pool_lock);
+    fprintf(stderr, "buffer pool: %u reused, %u allocated, %zu KB idle\n",
+            pool_hits, pool_misses, (size_t)g_atomic_pointer_get(&pool_idle_bytes) >> 10);
+    g_mutex_unlock(&pool_lock);
+}
+
+/* ---------- Render Workers ---------- */
+// Pages are rasterized on a small pool of threads, each owning a clone of
+// the main fz_context. The document itself is not thread-safe, so only the
+// page load / display list build runs under doc_lock; rasterization of the
+// display list happens unlocked and in parallel.
+#define RENDER_MAX_WORKERS 8
+
+// Pages whose full raster would exceed TILE_MIN_PAGE_BYTES are rendered as
+// TILE_SIZE square tiles, and only around the viewport.
+#define TILE_MIN_PAGE_BYTES ((size_t)32 << 20)
+
+static GMutex       fz_mutexes[FZ_LOCK_MAX];
+GMutex              doc_lock;
+gint                render_generation = 0;
+gint                thumb_generation  = 0;
+static GMutex       active_lock;
+static GAsyncQueue *render_queue = NULL;
+static GThread     *render_threads[RENDER_MAX_WORKERS];
+static fz_context  *render_ctxs[RENDER_MAX_WORKERS];
+static render_job  *active_jobs[RENDER_MAX_WORKERS];
+static int          render_thread_count = 0;
+static guint        render_seq = 0;
+static fz_context  *render_base = NULL;
+static GSourceFunc  render_done = NULL;
+static render_job   render_quit_job = { .priority = JOB_PRIO_QUIT };
+
+static void lock_mutex(void *user, int lock) {
+    g_mutex_lock(&((GMutex *)user)[lock]);
+}
+
+static void unlock_mutex(void *user, int lock) {
+    g_mutex_unlock(&((GMutex *)user)[lock]);
+}
+
+fz_locks_context render_locks = { fz_mutexes, lock_mutex, unlock_mutex };
+
+void render_job_free(render_job *job) {
+    if (job->surface) cairo_surface_destroy(job->surface);
+    fz_drop_stext_page(render_base, job->stext);
+    g_free(job->thumb);
+    fz_drop_document(render_base, job->doc);
+    g_free(job);
+}
+
+fz_irect page_pixel_bbox(fz_rect bounds, float zoom) {
+    return fz_round_rect(fz_transform_rect(bounds, fz_scale(zoom, zoom)));
+}
+
+int page_needs_tiles(fz_irect bbox) {
+    return (size_t)(bbox.x1 - bbox.x0) * (bbox.y1 - bbox.y0) * 4 > TILE_MIN_PAGE_BYTES;
+}
+
+// Tile (tx, ty) of a page raster, clipped to the page's edge.
+static fz_irect tile_pixel_bbox(fz_irect page, int tx, int ty) {
+    fz_irect tile = {
+        page.x0 + tx * TILE_SIZE,       page.y0 + ty * TILE_SIZE,
+        page.x0 + (tx + 1) * TILE_SIZE, page.y0 + (ty + 1) * TILE_SIZE,
+    };
+    return fz_intersect_irect(tile, page);
+}
+
+int render_job_is_stale(render_job *job) {
+    if (job->kind == JOB_TEXT) return 0;
+    gint current = g_atomic_int_get(job->kind == JOB_THUMB ? &thumb_generation : &render_generation);
+    return g_atomic_int_get(&job->generation) != current;
+}
+
+// Lower priority values are popped first; equal priorities stay FIFO.
+static gint render_job_compare(gconstpointer a, gconstpointer b, gpointer data) {
+    const render_job *ja = a, *jb = b;
+    if (ja->priority != jb->priority) return ja->priority < jb->priority ? -1 : 1;
+    return ja->seq < jb->seq ? -1 : (ja->seq > jb->seq);
+}
+
+// Direct drawing relies on Cairo's ARGB32 being BGRA in memory, which only
+// holds on little-endian hosts.
+int direct_render = (G_BYTE_ORDER == G_LITTLE_ENDIAN);
+
+// Creates the job's output surface and a pixmap MuPDF can draw into: either
+// an fz_device_bgr() pixmap with alpha over the surface's own buffer, or a
+// scratch RGB pixmap that finish_target_surface() converts. Both buffers
+// come from the pool; the caller returns scratch->data once the pixmap is
+// dropped, even if this throws.
+static fz_pixmap *new_target_pixmap(fz_context *c, int w, int h, cairo_surface_t **out, pooled_buffer *scratch) {
+    cairo_surface_t *surface = pixel_surface_new(w, h);
+    if (!surface) fz_throw(c, FZ_ERROR_GENERIC, "Cannot allocate %dx%d surface", w, h);
+    *out = surface;
+
+    if (direct_render) {
+        cairo_surface_flush(surface);
+        return fz_new_pixmap_with_data(c, fz_device_bgr(c), w, h, NULL, 1,
+                                       cairo_image_surface_get_stride(surface),
+                                       cairo_image_surface_get_data(surface));
+    }
+    scratch->data = pixel_buffer_get((size_t)w * 3 * h, &scratch->size);
+    if (!scratch->data) fz_throw(c, FZ_ERROR_GENERIC, "Cannot allocate %dx%d pixmap", w, h);
+    return fz_new_pixmap_with_data(c, fz_device_rgb(c), w, h, NULL, 0, w * 3, scratch->data);
+}
+
+static void finish_target_surface(fz_context *c, fz_pixmap *pix, cairo_surface_t *surface) {
+    if (!direct_render) {
+        int h = fz_pixmap_height(c, pix);
+        int w = fz_pixmap_width(c, pix);
+        int in_stride = fz_pixmap_stride(c, pix);
+        int out_stride = cairo_image_surface_get_stride(surface);
+        unsigned char *in = fz_pixmap_samples(c, pix);
+        unsigned char *out = cairo_image_surface_get_data(surface);
+
+        for (int y = 0; y < h; y++)
+            rgb_to_argb32(in + y * in_stride, out + y * out_stride, w);
+    }
+    cairo_surface_mark_dirty(surface);
+}
+
+/* ---------- Display List Cache ---------- */
+// Interpreting a page's content stream is often the expensive part, so each
+// page is turned into an fz_display_list once and every zoom level and tile
+// rasterizes from that. Shared by all workers under list_lock; the few most
+// recently used pages are kept. Entries hold a document reference, so a
+// stale entry can never be mistaken for a page of a newer document.
+#define LIST_CACHE_PAGES 8
+
+typedef struct list_entry {
+    fz_document     *doc;
+    int              page;
+    fz_display_list *list;
+    int              building;
+    GList            link;
+} list_entry;
+
+static GMutex list_lock;
+static GCond  list_cond;
+static GQueue list_lru    = G_QUEUE_INIT;
+static guint  list_hits   = 0;
+static guint  list_misses = 0;
+
+static list_entry *list_cache_find(fz_document *d, int page) {
+    for (GList *l = list_lru.head; l; l = l->next) {
+        list_entry *e = l->data;
+        if (e->doc == d && e->page == page) return e;
+    }
+    return NULL;
+}
+
+static void list_entry_free(fz_context *c, list_entry *e) {
+    fz_drop_display_list(c, e->list);
+    fz_drop_document(c, e->doc);
+    g_free(e);
+}
+
+// Drops least-recently-used lists beyond the limit. Entries that are still
+// being built are skipped. Called with list_lock held.
+static void list_cache_trim(fz_context *c, guint limit) {
+    GList *l = list_lru.tail;
+    while (l && list_lru.length > limit) {
+        GList *prev = l->prev;
+        list_entry *e = l->data;
+        if (!e->building) {
+            g_queue_unlink(&list_lru, &e->link);
+            list_entry_free(c, e);
+        }
+        l = prev;
+    }
+}
+
+// Timed from taking doc_lock, so waiting on other workers is not counted.
+fz_display_list *display_list_build(fz_context *c, fz_document *d, int page_no, render_timing *t) {
+    fz_page *page = NULL;
+    fz_display_list *list = NULL;
+    fz_var(page);
+
+    g_mutex_lock(&doc_lock);
+    fz_try(c) {
+        gint64 start = g_get_monotonic_time();
+        page = fz_load_page(c, d, page_no);
+        gint64 loaded = g_get_monotonic_time();
+        list = fz_new_display_list_from_page(c, page);
+        if (t) {
+            t->load_us = loaded - start;
+            t->list_us = g_get_monotonic_time() - loaded;
+        }
+    } fz_always(c) {
+        fz_drop_page(c, page);
+        g_mutex_unlock(&doc_lock);
+    } fz_catch(c) {
+        fz_rethrow(c);
+    }
+    return list;
+}
+
+// Concurrent requests for a page that is being built wait for that build
+// instead of repeating it.
+fz_display_list *display_list_acquire(fz_context *c, fz_document *d, int page_no, render_timing *t) {
+    list_entry *e;
+
+    g_mutex_lock(&list_lock);
+    while ((e = list_cache_find(d, page_no)) && e->building)
+        g_cond_wait(&list_cond, &list_lock);
+    if (e) {
+        list_hits++;
+        if (t) t->list_hit = 1;
+        g_queue_unlink(&list_lru, &e->link);
+        g_queue_push_head_link(&list_lru, &e->link);
+        fz_display_list *list = fz_keep_display_list(c, e->list);
+        g_mutex_unlock(&list_lock);
+        return list;
+    }
+    list_misses++;
+    e = g_new0(list_entry, 1);
+    e->doc       = fz_keep_document(c, d);
+    e->page      = page_no;
+    e->building  = 1;
+    e->link.data = e;
+    g_queue_push_head_link(&list_lru, &e->link);
+    g_mutex_unlock(&list_lock);
+
+    fz_display_list *list = NULL;
+    fz_try(c) {
+        list = display_list_build(c, d, page_no, t);
+    } fz_catch(c) {
+        g_mutex_lock(&list_lock);
+        g_queue_unlink(&list_lru, &e->link);
+        list_entry_free(c, e);
+        g_cond_broadcast(&list_cond);
+        g_mutex_unlock(&list_lock);
+        fz_rethrow(c);
+    }
+
+    g_mutex_lock(&list_lock);
+    e->list = fz_keep_display_list(c, list);
+    e->building = 0;
+    list_cache_trim(c, LIST_CACHE_PAGES);
+    g_cond_broadcast(&list_cond);
+    g_mutex_unlock(&list_lock);
+    return list;
+}
+
+void list_cache_clear(void) {
+    g_mutex_lock(&list_lock);
+    list_cache_trim(render_base, 0);
+    g_mutex_unlock(&list_lock);
+}
+
+void render_get_stats(render_stats *stats) {
+    stats->page_hits   = cache_hits;
+    stats->page_misses = cache_misses;
+    stats->page_bytes  = cache_bytes;
+    g_mutex_lock(&pool_lock);
+    stats->pool_hits       = pool_hits;
+    stats->pool_misses     = pool_misses;
+    stats->pool_idle_bytes = (size_t)g_atomic_pointer_get(&pool_idle_bytes);
+    g_mutex_unlock(&pool_lock);
+    g_mutex_lock(&list_lock);
+    stats->list_hits   = list_hits;
+    stats->list_misses = list_misses;
+    g_mutex_unlock(&list_lock);
+}
+
+/* ---------- Render Quality ---------- */
+// The draft profile keeps a little text AA so glyphs stay legible while
+// they move, and drops graphics AA and image interpolation, which is where
+// most of a large scan's raster time goes.
+render_quality render_profiles[RENDER_QUALITY_N] = {
+    [RENDER_QUALITY_FULL]  = { 8, 8, 1 },
+    [RENDER_QUALITY_DRAFT] = { 2, 0, 0 },
+};
+
+static const cairo_user_data_key_t draft_key;
+
+int render_surface_is_draft(cairo_surface_t *surface) {
+    return cairo_surface_get_user_data(surface, &draft_key) != NULL;
+}
+
+// AA levels live in each worker's own context, so they are set for every
+// job rather than left over from the last one.
+static fz_device *new_draw_device(fz_context *wctx, fz_pixmap *pix, int quality) {
+    const render_quality *q = &render_profiles[quality];
+    fz_set_text_aa_level(wctx, q->text_aa);
+    fz_set_graphics_aa_level(wctx, q->graphics_aa);
+    fz_device *dev = fz_new_draw_device(wctx, fz_identity, pix);
+    if (!q->interpolate) fz_enable_device_hints(wctx, dev, FZ_DONT_INTERPOLATE_IMAGES);
+    return dev;
+}
+
+/* ---------- Banded Rasterization ---------- */
+// A page wanted on screen now is rasterized on every core rather than on
+// its one worker: its rows are cut into bands, and each band is drawn by a
+// band thread with its own context straight into its slice of the job's
+// pixmap, so there is nothing to stitch or copy afterwards. The worker
+// draws the first band itself and waits for the rest. Band threads are
+// separate from the workers, so a worker waiting on its bands can never be
+// what those bands are queued behind. Prefetches and tiles, which already
+// run side by side on the workers, are not banded.
+#define BAND_MAX_THREADS 31
+#define BAND_MIN_BYTES   ((size_t)2 << 20)  // below this, handing out bands costs more than it saves
+#define BAND_MIN_ROWS    64
+
+typedef struct band_group {
+    GMutex lock;
+    GCond  done;
+    int    pending;
+} band_group;
+
+typedef struct band_task {
+    fz_display_list *list;
+    fz_pixmap       *pix;       // the whole page; the band draws rows y0..y1
+    fz_matrix        ctm;
+    int              y0, y1;
+    int              quality;
+    fz_cookie        cookie;
+    int              failed;
+    band_group      *group;
+} band_task;
+
+static GAsyncQueue *band_queue = NULL;
+static GThread     *band_threads[BAND_MAX_THREADS];
+static int          band_thread_count = 0;
+static band_task    band_quit_task;
+
+static void band_draw(fz_context *c, band_task *t, fz_cookie *cookie) {
+    fz_pixmap *slice = NULL;
+    fz_device *dev = NULL;
+
+    fz_var(slice);
+    fz_var(dev);
+
+    fz_try(c) {
+        int w = fz_pixmap_width(c, t->pix);
+        int h = t->y1 - t->y0;
+        int stride = fz_pixmap_stride(c, t->pix);
+        slice = fz_new_pixmap_with_data(c, fz_pixmap_colorspace(c, t->pix), w, h, NULL,
+                                        fz_pixmap_alpha(c, t->pix), stride,
+                                        fz_pixmap_samples(c, t->pix) + (size_t)t->y0 * stride);
+        dev = new_draw_device(c, slice, t->quality);
+        fz_run_display_list(c, t->list, dev, fz_concat(t->ctm, fz_translate(0, -t->y0)),
+                            fz_make_rect(0, 0, w, h), cookie);
+        fz_close_device(c, dev);
+    } fz_always(c) {
+        fz_drop_device(c, dev);
+        fz_drop_pixmap(c, slice);
+    } fz_catch(c) {
+        fprintf(stderr, "Error rendering band: %s\n", fz_caught_message(c));
+        t->failed = 1;
+    }
+}
+
+static gpointer band_thread(gpointer data) {
+    fz_context *c = data;
+    band_task *t;
+
+    while ((t = g_async_queue_pop(band_queue)) != &band_quit_task) {
+        if (!t->cookie.abort) band_draw(c, t, &t->cookie);
+        g_mutex_lock(&t->group->lock);
+        if (--t->group->pending == 0) g_cond_signal(&t->group->done);
+        g_mutex_unlock(&t->group->lock);
+    }
+    fz_drop_context(c);
+    return NULL;
+}
+
+// How many bands a job's pixmap is worth splitting into; 1 draws it whole.
+static int band_count(render_job *job, fz_pixmap *pix, fz_context *c) {
+    int w = fz_pixmap_width(c, pix);
+    int h = fz_pixmap_height(c, pix);
+    if (job->prefetch || job->key.tx >= 0 || band_thread_count == 0) return 1;
+    if ((size_t)w * h * 4 < BAND_MIN_BYTES) return 1;
+    return CLAMP(h / BAND_MIN_ROWS, 1, band_thread_count + 1);
+}
+
+// Draws list into pix in n bands. Aborting the job aborts every band; the
+// waiting worker passes the job's abort on to bands that are still going.
+static void draw_banded(fz_context *wctx, render_job *job, fz_display_list *list,
+                        fz_pixmap *pix, fz_matrix ctm, int n) {
+    band_task tasks[BAND_MAX_THREADS + 1];
+    band_group group;
+    int h = fz_pixmap_height(wctx, pix);
+
+    g_mutex_init(&group.lock);
+    g_cond_init(&group.done);
+    group.pending = n - 1;
+    for (int i = 0; i < n; i++) {
+        tasks[i] = (band_task){
+            .list = list, .pix = pix, .ctm = ctm,
+            .y0 = (int)((gint64)h * i / n), .y1 = (int)((gint64)h * (i + 1) / n),
+            .quality = job->quality, .group = &group,
+        };
+    }
+    for (int i = 1; i < n; i++)
+        g_async_queue_push(band_queue, &tasks[i]);
+
+    band_draw(wctx, &tasks[0], &job->cookie);
+
+    g_mutex_lock(&group.lock);
+    while (group.pending > 0) {
+        if (job->cookie.abort)
+            for (int i = 1; i < n; i++) tasks[i].cookie.abort = 1;
+        g_cond_wait_until(&group.done, &group.lock, g_get_monotonic_time() + 2 * G_TIME_SPAN_MILLISECOND);
+    }
+    g_mutex_unlock(&group.lock);
+    g_mutex_clear(&group.lock);
+    g_cond_clear(&group.done);
+
+    for (int i = 0; i < n; i++) {
+        if (tasks[i].failed) fz_throw(wctx, FZ_ERROR_GENERIC, "Band %d of %d failed", i, n);
+    }
+}
+
+static void band_threads_start(fz_context *base) {
+    int n = (int)g_get_num_processors() - 1;
+    n = CLAMP(n, 0, BAND_MAX_THREADS);
+
+    band_queue = g_async_queue_new();
+    for (int i = 0; i < n; i++) {
+        fz_context *c = fz_clone_context(base);
+        if (!c) break;
+        band_threads[i] = g_thread_new("band", band_thread, c);
+        band_thread_count++;
+    }
+}
+
+// Only called once the workers have stopped, so no band is queued.
+static void band_threads_stop(void) {
+    for (int i = 0; i < band_thread_count; i++)
+        g_async_queue_push(band_queue, &band_quit_task);
+    for (int i = 0; i < band_thread_count; i++)
+        g_thread_join(band_threads[i]);
+    band_thread_count = 0;
+    g_async_queue_unref(band_queue);
+    band_queue = NULL;
+}
+
+static void render_job_run(fz_context *wctx, render_job *job) {
+    fz_display_list *list = NULL;
+    fz_pixmap *pix = NULL;
+    fz_device *dev = NULL;
+    pooled_buffer scratch = { NULL, 0 };
+
+    fz_var(list);
+    fz_var(pix);
+    fz_var(dev);
+    fz_var(scratch);
+
+    fz_try(wctx) {
+        list = display_list_acquire(wctx, job->doc, job->page, &job->timing);
+        job->bounds = fz_bound_display_list(wctx, list);
+        job->have_bounds = 1;
+        fz_irect bbox = page_pixel_bbox(job->bounds, job->zoom);
+        if (job->key.tx >= 0) {
+            bbox = tile_pixel_bbox(bbox, job->key.tx, job->key.ty);
+        } else if (page_needs_tiles(bbox)) {
+            // Report the size only; the main thread switches to tiles.
+            job->too_large = 1;
+            break;
+        }
+
+        int w = bbox.x1 - bbox.x0;
+        int h = bbox.y1 - bbox.y0;
+        fz_matrix ctm = fz_concat(fz_scale(job->zoom, job->zoom), fz_translate(-bbox.x0, -bbox.y0));
+
+        gint64 start = g_get_monotonic_time();
+        pix = new_target_pixmap(wctx, w, h, &job->surface, &scratch);
+        fz_clear_pixmap_with_value(wctx, pix, 0xff);
+        gint64 allocated = g_get_monotonic_time();
+
+        int bands = band_count(job, pix, wctx);
+        if (bands > 1) {
+            draw_banded(wctx, job, list, pix, ctm, bands);
+        } else {
+            dev = new_draw_device(wctx, pix, job->quality);
+            fz_run_display_list(wctx, list, dev, ctm, fz_make_rect(0, 0, w, h), &job->cookie);
+            fz_close_device(wctx, dev);
+        }
+        gint64 drawn = g_get_monotonic_time();
+
+        finish_target_surface(wctx, pix, job->surface);
+        if (job->device_scale > 0)
+            cairo_surface_set_device_scale(job->surface, job->device_scale, job->device_scale);
+        if (job->quality == RENDER_QUALITY_DRAFT)
+            cairo_surface_set_user_data(job->surface, &draft_key, (void *)1, NULL);
+        job->timing.surface_us = allocated - start;
+        job->timing.raster_us  = drawn - allocated;
+        job->timing.convert_us = g_get_monotonic_time() - drawn;
+    } fz_always(wctx) {
+        fz_drop_device(wctx, dev);
+        fz_drop_pixmap(wctx, pix);
+        pixel_buffer_put(scratch.data, scratch.size);
+        fz_drop_display_list(wctx, list);
+    } fz_catch(wctx) {
+        fprintf(stderr, "Error rendering page: %s\n", fz_caught_message(wctx));
+        job->failed = 1;
+    }
+
+    if ((job->failed || job->cookie.abort) && job->surface) {
+        cairo_surface_destroy(job->surface);
+        job->surface = NULL;
+    }
+}
+
+static void text_job_run(fz_context *wctx, render_job *job) {
+    fz_display_list *list = NULL;
+    fz_var(list);
+
+    fz_try(wctx) {
+        list = display_list_acquire(wctx, job->doc, job->page, &job->timing);
+        job->stext = fz_new_stext_page_from_display_list(wctx, list, NULL);
+    } fz_always(wctx) {
+        fz_drop_display_list(wctx, list);
+    } fz_catch(wctx) {
+        fprintf(stderr, "Error extracting text: %s\n", fz_caught_message(wctx));
+        job->failed = 1;
+    }
+}
+
+// Thumbnails are about 16 KB a page as RGB565. They are drawn from a list
+// built just for them, like the search pass, so the pages on screen keep
+// their cached lists.
+static void thumb_job_run(fz_context *wctx, render_job *job) {
+    fz_display_list *list = NULL;
+    fz_pixmap *pix = NULL;
+    fz_device *dev = NULL;
+
+    fz_var(list);
+    fz_var(pix);
+    fz_var(dev);
+
+    fz_try(wctx) {
+        list = display_list_build(wctx, job->doc, job->page, &job->timing);
+        job->bounds = fz_bound_display_list(wctx, list);
+        job->have_bounds = 1;
+        float pw = job->bounds.x1 - job->bounds.x0;
+        float ph = job->bounds.y1 - job->bounds.y0;
+        if (pw <= 0 || ph <= 0) fz_throw(wctx, FZ_ERROR_GENERIC, "Empty page");
+
+        float scale = fminf(THUMB_W / pw, THUMB_H / ph);
+        fz_irect bbox = page_pixel_bbox(job->bounds, scale);
+        int w = MAX(bbox.x1 - bbox.x0, 1);
+        int h = MAX(bbox.y1 - bbox.y0, 1);
+        fz_matrix ctm = fz_concat(fz_scale(scale, scale), fz_translate(-bbox.x0, -bbox.y0));
+
+        pix = fz_new_pixmap(wctx, fz_device_rgb(wctx), w, h, NULL, 0);
+        fz_clear_pixmap_with_value(wctx, pix, 0xff);
+        dev = new_draw_device(wctx, pix, job->quality);
+        fz_run_display_list(wctx, list, dev, ctm, fz_make_rect(0, 0, w, h), &job->cookie);
+        fz_close_device(wctx, dev);
+
+        const unsigned char *in = fz_pixmap_samples(wctx, pix);
+        int stride = fz_pixmap_stride(wctx, pix);
+        job->thumb = g_new(guint16, (size_t)w * h);
+        for (int y = 0; y < h; y++) {
+            const unsigned char *p = in + (size_t)y * stride;
+            guint16 *out = job->thumb + (size_t)y * w;
+            for (int x = 0; x < w; x++, p += 3)
+                out[x] = (guint16)(((p[0] >> 3) << 11) | ((p[1] >> 2) << 5) | (p[2] >> 3));
+        }
+        job->thumb_w = w;
+        job->thumb_h = h;
+    } fz_always(wctx) {
+        fz_drop_device(wctx, dev);
+        fz_drop_pixmap(wctx, pix);
+        fz_drop_display_list(wctx, list);
+    } fz_catch(wctx) {
+        if (!job->cookie.abort)
+            fprintf(stderr, "Error rendering thumbnail: %s\n", fz_caught_message(wctx));
+        job->failed = 1;
+    }
+
+    if ((job->failed || job->cookie.abort) && job->thumb) {
+        g_free(job->thumb);
+        job->thumb = NULL;
+    }
+}
+
+static gpointer render_worker(gpointer data) {
+    int slot = GPOINTER_TO_INT(data);
+    fz_context *wctx = render_ctxs[slot];
+
+    for (;;) {
+        render_job *job = g_async_queue_pop(render_queue);
+        if (job == &render_quit_job) break;
+        job->timing.wait_us = g_get_monotonic_time() - job->queued_at;
+
+        if (!render_job_is_stale(job)) {
+            g_mutex_lock(&active_lock);
+            active_jobs[slot] = job;
+            g_mutex_unlock(&active_lock);
+
+            if (job->kind == JOB_TEXT)
+                text_job_run(wctx, job);
+            else if (job->kind == JOB_THUMB)
+                thumb_job_run(wctx, job);
+            else
+                render_job_run(wctx, job);
+
+            g_mutex_lock(&active_lock);
+            active_jobs[slot] = NULL;
+            g_mutex_unlock(&active_lock);
+        } else {
+            // Skipped: mark it so it is not adopted while on its way back.
+            job->cookie.abort = 1;
+        }
+        g_idle_add(render_done, job);
+    }
+
+    fz_drop_context(wctx);
+    render_ctxs[slot] = NULL;
+    return NULL;
+}
+
+void render_cancel_stale(void) {
+    g_mutex_lock(&active_lock);
+    for (int i = 0; i < render_thread_count; i++) {
+        if (active_jobs[i] && render_job_is_stale(active_jobs[i]))
+            active_jobs[i]->cookie.abort = 1;
+    }
+    g_mutex_unlock(&active_lock);
+}
+
+void render_queue_push(render_job *job) {
+    job->seq       = render_seq++;
+    job->queued_at = g_get_monotonic_time();
+    g_async_queue_push_sorted(render_queue, job, render_job_compare, NULL);
+}
+
+int render_job_promote(render_job *job, int priority) {
+    if (!render_queue) return 0;
+
+    g_async_queue_lock(render_queue);
+    int queued = g_async_queue_remove_unlocked(render_queue, job);
+    if (queued) {
+        job->priority = MIN(job->priority, priority);
+        g_async_queue_push_sorted_unlocked(render_queue, job, render_job_compare, NULL);
+    }
+    g_async_queue_unlock(render_queue);
+    if (queued) return 1;
+
+    int running = 0;
+    g_mutex_lock(&active_lock);
+    for (int i = 0; i < render_thread_count; i++)
+        if (active_jobs[i] == job) running = 1;
+    g_mutex_unlock(&active_lock);
+    return running;
+}
+
+int render_queue_depth(void) {
+    return render_queue ? MAX(g_async_queue_length(render_queue), 0) : 0;
+}
+
+void render_pool_start(fz_context *base, GSourceFunc done) {
+    int n = (int)g_get_num_processors() - 1;
+    n = CLAMP(n, 1, RENDER_MAX_WORKERS);
+
+    render_base  = base;
+    render_done  = done;
+    render_queue = g_async_queue_new();
+    for (int i = 0; i < n; i++) {
+        render_ctxs[i] = fz_clone_context(base);
+        if (!render_ctxs[i]) break;
+        render_threads[i] = g_thread_new("render", render_worker, GINT_TO_POINTER(i));
+        render_thread_count++;
+    }
+    band_threads_start(base);
+}
+
+void render_pool_stop(void) {
+    if (!render_queue) return;
+
+    g_atomic_int_inc(&render_generation);
+    render_cancel_stale();
+    for (int i = 0; i < render_thread_count; i++)
+        g_async_queue_push_sorted(render_queue, &render_quit_job, render_job_compare, NULL);
+    for (int i = 0; i < render_thread_count; i++)
+        g_thread_join(render_threads[i]);
+    render_thread_count = 0;
+    band_threads_stop();
+
+    // The quit jobs sort first, so anything queued behind them is handed
+    // back unrun, marked skipped like any stale job.
+    render_job *job;
+    while ((job = g_async_queue_try_pop(render_queue))) {
+        if (job == &render_quit_job) continue;
+        job->cookie.abort = 1;
+        g_idle_add(render_done, job);
+    }
+
+    // Release whatever the workers posted back after the main loop stopped.
+    while (g_main_context_iteration(NULL, FALSE));
+
+    g_async_queue_unref(render_queue);
+    render_queue = NULL;
+}
@@ -0,0 +1,220 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <glib.h>
+#include <cairo.h>
+#include <mupdf/fitz.h>
+
+// The render core shared by the viewer and guf-bench: the memory budget and
+// MuPDF allocator, the page surface cache, the per-page display list cache
+// and the pool of render workers. None of it knows about widgets; finished
+// jobs are handed back on the main loop through the callback given to
+// render_pool_start().
+
+/* ---------- Memory Budget ---------- */
+// One budget (--cache-mb / GUF_CACHE_MB) covers both MuPDF and the page
+// cache. Create the fz_context with render_alloc, render_locks and
+// store_limit() so MuPDF's allocations are counted against it.
+extern size_t           cache_budget;
+extern fz_alloc_context render_alloc;
+extern fz_locks_context render_locks;
+
+size_t store_limit(void);
+size_t mupdf_bytes(void);
+// What the page surface cache may hold right now.
+size_t page_cache_limit(void);
+
+/* ---------- Pixel Buffer Pool ---------- */
+// Pixel memory for page surfaces and scratch pixmaps, recycled through
+// size-classed free lists rather than malloc'd and freed per render. Any
+// thread may take and return buffers.
+void *pixel_buffer_get(size_t size, size_t *class_size);
+void  pixel_buffer_put(void *data, size_t class_size);
+
+// An ARGB32 image surface over a pooled buffer, which goes back to the
+// pool when the surface is destroyed. NULL if memory runs out.
+cairo_surface_t *pixel_surface_new(int w, int h);
+// The pixel memory surface holds, including any rounding up by the pool.
+size_t           pixel_surface_bytes(cairo_surface_t *surface);
+
+/* ---------- Page Surface Cache ---------- */
+// Rendered surfaces keyed by (page, zoom bucket, tile); whole-page surfaces
+// use tile (-1, -1). Main thread only.
+typedef struct cache_key {
+    int page;
+    int zoom;
+    int tx, ty;
+} cache_key;
+
+guint     cache_key_hash(gconstpointer p);
+gboolean  cache_key_equal(gconstpointer a, gconstpointer b);
+cache_key make_tile_key(int page, float zoom, int tx, int ty);
+cache_key make_cache_key(int page, float zoom);
+
+// Reads GUF_CACHE_MB. Each entry can carry one attachment made from its
+// surface (the viewer keeps a GdkTexture there); attachment_free, if not
+// NULL, releases it when the entry goes.
+void page_cache_init(GDestroyNotify attachment_free);
+void page_cache_clear(void);
+
+// Returns a borrowed surface and marks it most recently used, or NULL on a
+// miss. page_cache_lookup() also feeds the hit/miss counters.
+cairo_surface_t *page_cache_peek(cache_key key);
+cairo_surface_t *page_cache_lookup(cache_key key);
+void             page_cache_insert(cache_key key, cairo_surface_t *surface);
+int              page_cache_contains(cache_key key);
+
+// The cached whole-page render of page whose zoom is closest to zoom (by
+// ratio), or NULL. Does not touch the LRU order or the counters.
+cairo_surface_t *page_cache_closest(int page, float zoom, float *found_zoom);
+
+// Whether key's entry was rendered with the draft profile (see Render
+// Quality); 0 if there is no entry.
+int page_cache_is_draft(cache_key key);
+
+// The attachment slot of the entry holding surface under key, or NULL if
+// key caches another surface or none. An empty slot may be filled with
+// anything attachment_free can release. Does not touch the LRU order.
+gpointer *page_cache_attachment(cache_key key, cairo_surface_t *surface);
+
+typedef struct render_stats {
+    guint  page_hits, page_misses;
+    guint  list_hits, list_misses;
+    guint  pool_hits, pool_misses;
+    size_t page_bytes;
+    size_t pool_idle_bytes;
+} render_stats;
+
+void render_get_stats(render_stats *stats);
+// Prints cache and MuPDF memory use to stderr.
+void page_cache_report(void);
+
+/* ---------- Render Quality ---------- */
+// Profiles a render job can ask for. The viewer renders with the draft one
+// while the user is scrolling and with the full one otherwise; the draft
+// surfaces are tagged so they can be replaced once things are idle.
+enum {
+    RENDER_QUALITY_FULL,
+    RENDER_QUALITY_DRAFT,
+    RENDER_QUALITY_N,
+};
+
+typedef struct render_quality {
+    int text_aa;        // fz_set_text_aa_level: 0 (off) to 8 bits
+    int graphics_aa;    // fz_set_graphics_aa_level, likewise
+    int interpolate;    // smooth images drawn at other than 1:1
+} render_quality;
+
+// Indexed by RENDER_QUALITY_*; may be changed before render_pool_start().
+extern render_quality render_profiles[RENDER_QUALITY_N];
+
+int render_surface_is_draft(cairo_surface_t *surface);
+
+/* ---------- Render Workers ---------- */
+// Pages whose full raster would be too large for one surface are rendered
+// as TILE_SIZE square tiles.
+#define TILE_SIZE 256
+
+// Thumbnails fit THUMB_W x THUMB_H and are kept as RGB565.
+#define THUMB_W 80
+#define THUMB_H 104
+
+enum {
+    JOB_PRIO_QUIT     = -1,
+    JOB_PRIO_PREVIEW  = 0,
+    JOB_PRIO_VISIBLE  = 1,
+    JOB_PRIO_PREFETCH = 10,
+    JOB_PRIO_TEXT     = 20,
+    JOB_PRIO_THUMB    = 30,
+};
+
+enum {
+    JOB_RENDER,
+    JOB_TEXT,   // structured text extraction; never goes stale
+    JOB_THUMB,  // sidebar thumbnail; stale once scrolled out of the strip
+};
+
+// Where a job's time went, in microseconds, for the viewer's HUD and trace
+// log. Stages a job did not reach stay 0.
+typedef struct render_timing {
+    gint64 wait_us;     // queued until a worker took it
+    gint64 load_us;     // fz_load_page
+    gint64 list_us;     // recording the display list
+    gint64 surface_us;  // allocating the surface and pixmap
+    gint64 raster_us;   // running the display list
+    gint64 convert_us;  // RGB to ARGB32, or flushing the surface
+    int    list_hit;    // the display list came from the cache
+} render_timing;
+
+typedef struct render_job {
+    int              kind;
+    int              page;
+    float            zoom;
+    float            device_scale;  // if > 0, tagged on the surface, so it draws at zoom / device_scale
+    cache_key        key;
+    int              priority;
+    int              quality;   // RENDER_QUALITY_*
+    guint            seq;
+    int              prefetch;
+    int              preview;
+    gint             generation;
+    fz_document     *doc;
+    fz_cookie        cookie;
+    cairo_surface_t *surface;
+    fz_stext_page   *stext;
+    guint16         *thumb;     // JOB_THUMB result, RGB565
+    int              thumb_w, thumb_h;
+    fz_rect          bounds;
+    int              have_bounds;
+    int              too_large;
+    int              failed;
+    gint64           queued_at;
+    render_timing    timing;
+} render_job;
+
+// Held around any use of a document that workers may also be loading from.
+extern GMutex doc_lock;
+
+// Bumping a generation makes every queued job of that generation stale:
+// workers skip it, or abort it via its cookie if it is already running.
+// Thumbnails have their own, so the strip can drop them on its own.
+extern gint render_generation;
+extern gint thumb_generation;
+
+// When set, workers draw straight into the Cairo surface; otherwise they
+// render RGB and convert with rgb_to_argb32.
+extern int direct_render;
+
+fz_irect page_pixel_bbox(fz_rect bounds, float zoom);
+int      page_needs_tiles(fz_irect bbox);
+int      render_job_is_stale(render_job *job);
+void     render_job_free(render_job *job);
+
+// Starts one worker per spare core, each with a clone of base. Every job
+// pushed is handed to done(job) on the default main context once it has
+// run or been skipped; done owns it from then on. Stopping drains the
+// main context so those calls still happen.
+void render_pool_start(fz_context *base, GSourceFunc done);
+void render_pool_stop(void);
+// Queues job in priority order; equal priorities stay FIFO.
+void render_queue_push(render_job *job);
+// Moves a queued job up to priority (keeping its place among jobs already
+// there). Returns 1 if it is queued at that priority now or a worker is
+// running it, 0 if it has left the queue otherwise (skipped, finished or
+// on its way back), in which case the caller should queue a fresh one.
+int  render_job_promote(render_job *job, int priority);
+// Abort in-flight rasterization for anything the user has already moved past.
+void render_cancel_stale(void);
+// Jobs queued and not yet taken by a worker.
+int  render_queue_depth(void);
+
+/* ---------- Display List Cache ---------- */
+// Loads and records one page, bypassing the cache. t, if not NULL, gets
+// the load and record times.
+fz_display_list *display_list_build(fz_context *c, fz_document *d, int page_no, render_timing *t);
+// Returns a new reference to the page's cached display list, building it
+// under doc_lock if no other worker has.
+fz_display_list *display_list_acquire(fz_context *c, fz_document *d, int page_no, render_timing *t);
+void             list_cache_clear(void);
+
+#endif